@@ -10,6 +10,16 @@ struct array {
     void_ptr *as;
 };
 
+// shared state of the parallel foreach and reduce passes
+typedef struct {
+    array *arr;
+    size_t grain;
+    void_ptr *dest;
+    size_t *counts;
+    void_ptr (*map)(void_ptr);
+    bool (*keep)(void_ptr);
+} arr_par;
+
 array *arr_init(size_t m) {
     array *arr = malloc(sizeof(array));
 
@@ -113,3 +123,102 @@ size_t arr_reduce(array *arr, bool (*func)(void_ptr)) {
 
     return arr->n;
 }
+
+static void_ptr arr_par_map(void_ptr ctx, size_t lo, size_t hi) {
+    arr_par *p = (arr_par *) ctx;
+    size_t i;
+    for (i = lo; i < hi; i++) {
+        p->arr->as[i] = (p->map)(p->arr->as[i]);
+    }
+
+    return null;
+}
+
+// filter a chunk in place towards its own start and record how many survived
+static void_ptr arr_par_filter(void_ptr ctx, size_t lo, size_t hi) {
+    arr_par *p = (arr_par *) ctx;
+    size_t i, c = lo;
+    for (i = lo; i < hi; i++) {
+        if ((p->keep)(p->arr->as[i])) {
+            p->arr->as[c++] = p->arr->as[i];
+        }
+    }
+    p->counts[lo / p->grain] = c - lo;
+
+    return null;
+}
+
+// copy a chunk's survivors to their final offset, counts has been turned into offsets by now
+static void_ptr arr_par_compact(void_ptr ctx, size_t lo, size_t hi) {
+    arr_par *p = (arr_par *) ctx;
+    size_t c = lo / p->grain;
+    size_t n = p->counts[c + 1] - p->counts[c];
+    // the survivors sit at the start of the chunk and never run past it
+    n = n < hi - lo ? n : hi - lo;
+    memcpy(&p->dest[p->counts[c]], &p->arr->as[lo], n * sizeof(void_ptr));
+
+    return null;
+}
+
+int arr_parallel_foreach(array *arr, threadpool *pool, void_ptr (*func)(void_ptr), size_t grain) {
+    if (pool == null) {
+        arr_foreach(arr, func);
+        return 0;
+    }
+
+    arr_par p;
+    p.arr = arr;
+    p.map = func;
+
+    return tp_parallel_for(pool, arr->n, grain, arr_par_map, &p);
+}
+
+size_t arr_parallel_reduce(array *arr, threadpool *pool, bool (*func)(void_ptr), size_t grain) {
+    arr_par p;
+    p.arr = arr;
+    p.keep = func;
+
+    if (pool == null || arr->n == 0) {
+        return arr_reduce(arr, func);
+    }
+    p.grain = grain == 0 ? tp_grain(pool, arr->n) : grain;
+
+    size_t i, chunks = arr->n / p.grain + (arr->n % p.grain != 0);
+    if ((p.counts = malloc((chunks + 1) * sizeof(size_t))) == null ||
+            (p.dest = malloc(arr->m * sizeof(void_ptr))) == null) {
+        // not enough memory for the parallel pass, fall back to the serial one
+        free(p.counts);
+        return arr_reduce(arr, func);
+    }
+
+    // filter each chunk, then turn the survivor counts into output offsets
+    // a failed pass runs no chunk at all, so the serial reduce still sees the original items
+    if (tp_parallel_for(pool, arr->n, p.grain, arr_par_filter, &p) != 0) {
+        free(p.counts);
+        free(p.dest);
+        return arr_reduce(arr, func);
+    }
+
+    size_t off = 0;
+    for (i = 0; i < chunks; i++) {
+        size_t c = p.counts[i];
+        p.counts[i] = off;
+        off += c;
+    }
+    p.counts[chunks] = off;
+
+    // move the survivors into the new backing array in parallel, or here if the pool can't take the pass
+    if (tp_parallel_for(pool, arr->n, p.grain, arr_par_compact, &p) != 0) {
+        for (i = 0; i < chunks; i++) {
+            size_t lo = i * p.grain;
+            arr_par_compact(&p, lo, lo + p.grain < arr->n ? lo + p.grain : arr->n);
+        }
+    }
+
+    free(arr->as);
+    free(p.counts);
+    arr->as = p.dest;
+    arr->n = off;
+
+    return arr->n;
+}
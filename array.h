@@ -2,6 +2,7 @@
 #define ARRAY
 
 #include "defs.h"
+#include "threadpool.h"
 
 typedef struct array array;
 
@@ -32,4 +33,12 @@ extern void arr_foreach(array *arr, void_ptr (*func)(void_ptr));
 // remove the items marked with false by the function, returns the new size of the array
 extern size_t arr_reduce(array *arr, bool (*func)(void_ptr));
 
+// arr_foreach split into chunks of 'grain' items run on the threadpool, a grain of 0 uses tp_grain
+// returns 0 on success and an err_tp on failure
+extern int arr_parallel_foreach(array *arr, threadpool *pool, void_ptr (*func)(void_ptr), size_t grain);
+
+// arr_reduce split into chunks of 'grain' items run on the threadpool, survivors keep their order
+// returns the new size of the array
+extern size_t arr_parallel_reduce(array *arr, threadpool *pool, bool (*func)(void_ptr), size_t grain);
+
 #endif // ARRAY
\ No newline at end of file
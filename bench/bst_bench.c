@@ -0,0 +1,99 @@
+// random inserts into the B+tree against the sorted array as the set grows
+// build from the repo root: cc -std=gnu11 -O2 -I. bench/bst_bench.c bst.c bsa.c
+// usage: ./a.out [max power of ten] [max power of ten for bsa]
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "bsa.h"
+#include "bst.h"
+
+static int cmp(const void_ptr a, const void_ptr b) {
+    uint64_t x = *(uint64_t const *) a, y = *(uint64_t const *) b;
+    return (x > y) - (x < y);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    int top = argc > 1 ? atoi(argv[1]) : 7;
+    int bsa_top = argc > 2 ? atoi(argv[2]) : 5;
+    size_t i, n, max = 1;
+    int p;
+    for (p = 0; p < top; p++) {
+        max *= 10;
+    }
+
+    uint64_t *keys;
+    if ((keys = malloc(max * sizeof(uint64_t))) == null) {
+        return 1;
+    }
+    uint64_t x = 88172645463325252u;
+    for (i = 0; i < max; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        keys[i] = x;
+    }
+
+    // time each decade of inserts on its own, so the cost per insert shows how it grows with the size
+    bst *t = bst_init(cmp);
+    bsa *b = bsa_init(cmp);
+    size_t from = 0, bsa_max = 1;
+    for (p = 0; p < bsa_top; p++) {
+        bsa_max *= 10;
+    }
+    for (n = 10; n <= max; n *= 10) {
+        double start = now();
+        for (i = from; i < n; i++) {
+            bst_push(t, &keys[i]);
+        }
+        double tt = now() - start;
+
+        printf("size %-9zu bst %7.1f ns/insert", n, tt * 1e9 / (double) (n - from));
+        if (n <= bsa_max) {
+            start = now();
+            for (i = from; i < n; i++) {
+                bsa_push(b, &keys[i]);
+            }
+            printf("  bsa %9.1f ns/insert", (now() - start) * 1e9 / (double) (n - from));
+        }
+        printf("\n");
+        from = n;
+    }
+
+    // lookups of every key, then a bulk load of the same keys sorted
+    double start = now();
+    size_t hits = 0;
+    for (i = 0; i < max; i++) {
+        hits += bst_has(t, &keys[i]);
+    }
+    printf("has        %7.1f ns/lookup (%zu found)\n", (now() - start) * 1e9 / (double) max, hits);
+    bst_free(t);
+    bsa_free(b);
+
+    void_ptr *sorted;
+    if ((sorted = malloc(max * sizeof(void_ptr))) == null) {
+        return 1;
+    }
+    t = bst_init(cmp);
+    for (i = 0; i < max; i++) {
+        bst_push(t, &keys[i]);
+    }
+    for (i = 0; i < max; i++) {
+        sorted[i] = bst_pop(t);
+    }
+    bst_free(t);
+    start = now();
+    t = bst_load(cmp, sorted, max);
+    printf("load       %7.1f ns/item\n", (now() - start) * 1e9 / (double) max);
+    bst_free(t);
+    free(sorted);
+    free(keys);
+
+    return 0;
+}
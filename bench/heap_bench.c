@@ -0,0 +1,80 @@
+// push/pop throughput of the binary heap against the 4-ary and 8-ary cache-aligned layouts
+// build from the repo root: cc -std=gnu11 -O2 -I. bench/heap_bench.c heap.c
+// usage: ./a.out [max power of ten, 8 needs about 2 GB]
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "heap.h"
+
+static bool lt(void const *a, void const *b) {
+    return *(uint64_t const *) a < *(uint64_t const *) b;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+// push the 'n' keys then pop them all, report ns per push and per pop; d of 0 is the binary h_init heap
+static void run(uint64_t *keys, size_t n, size_t d) {
+    heap *h = d == 0 ? h_init(n + 1, lt) : h_init_d(n + 1, d, lt);
+    if (h == null) {
+        fprintf(stderr, "out of memory at n %zu\n", n);
+        exit(1);
+    }
+
+    size_t i;
+    double t = now();
+    for (i = 0; i < n; i++) {
+        h_push(h, &keys[i]);
+    }
+    double push = now() - t;
+
+    uint64_t prev = 0;
+    t = now();
+    for (i = 0; i < n; i++) {
+        uint64_t k = *(uint64_t *) h_pop(h);
+        if (k < prev) {
+            fprintf(stderr, "out of order pop\n");
+            exit(1);
+        }
+        prev = k;
+    }
+    double pop = now() - t;
+
+    printf("n %-10zu d %-2zu push %7.1f ns  pop %7.1f ns\n", n, d == 0 ? (size_t) 2 : d,
+            push * 1e9 / (double) n, pop * 1e9 / (double) n);
+    h_free(h);
+}
+
+int main(int argc, char **argv) {
+    int top = argc > 1 ? atoi(argv[1]) : 7;
+    size_t n, max = 1;
+    int p;
+    for (p = 0; p < top; p++) {
+        max *= 10;
+    }
+
+    uint64_t *keys;
+    if ((keys = malloc(max * sizeof(uint64_t))) == null) {
+        return 1;
+    }
+    uint64_t x = 88172645463325252u;
+    for (n = 0; n < max; n++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        keys[n] = x;
+    }
+
+    for (n = 1000; n <= max; n *= 10) {
+        run(keys, n, 0);
+        run(keys, n, 4);
+        run(keys, n, 8);
+    }
+    free(keys);
+
+    return 0;
+}
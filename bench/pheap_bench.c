@@ -0,0 +1,117 @@
+// the pairing heap against the array heap on a push-heavy and a merge-heavy workload
+// build from the repo root: cc -std=gnu11 -O2 -I. bench/pheap_bench.c pheap.c heap.c
+// usage: ./a.out [items] [shards]
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "heap.h"
+#include "pheap.h"
+
+static bool lt(void const *a, void const *b) {
+    return *(uint64_t const *) a < *(uint64_t const *) b;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+// every item pushed, with one pop after every fourth push, then the rest drained
+static void push_heavy(uint64_t *keys, size_t n) {
+    size_t i;
+    double t = now();
+    heap *h = h_init(16, lt);
+    for (i = 0; i < n; i++) {
+        h_push(h, &keys[i]);
+        if (i % 4 == 3) {
+            h_pop(h);
+        }
+    }
+    while (!h_empty(h)) {
+        h_pop(h);
+    }
+    h_free(h);
+    double th = now() - t;
+
+    t = now();
+    pheap *p = ph_init(16, lt);
+    for (i = 0; i < n; i++) {
+        ph_push(p, &keys[i]);
+        if (i % 4 == 3) {
+            ph_pop(p);
+        }
+    }
+    while (!ph_empty(p)) {
+        ph_pop(p);
+    }
+    ph_free(p);
+    double tp = now() - t;
+
+    printf("push-heavy  n %-9zu heap %7.1f ns/item  pheap %7.1f ns/item\n", n,
+            th * 1e9 / (double) n, tp * 1e9 / (double) n);
+}
+
+// fill 's' shards, fold them into one by merging, pop a little off the merged heap, and repeat
+static void merge_heavy(uint64_t *keys, size_t n, size_t s) {
+    size_t i, j, per = n / s, rounds = 8;
+    double t = now();
+    for (j = 0; j < rounds; j++) {
+        heap *all = h_init(16, lt);
+        for (i = 0; i < s; i++) {
+            heap *h = h_init(per, lt);
+            size_t k;
+            for (k = 0; k < per; k++) {
+                h_push(h, &keys[i * per + k]);
+            }
+            h_concat(all, h);
+            h_pop(all);
+        }
+        h_free(all);
+    }
+    double th = now() - t;
+
+    t = now();
+    for (j = 0; j < rounds; j++) {
+        pheap *all = ph_init(16, lt);
+        for (i = 0; i < s; i++) {
+            pheap *p = ph_init(per, lt);
+            size_t k;
+            for (k = 0; k < per; k++) {
+                ph_push(p, &keys[i * per + k]);
+            }
+            ph_concat(all, p);
+            ph_pop(all);
+        }
+        ph_free(all);
+    }
+    double tp = now() - t;
+
+    printf("merge-heavy n %-9zu shards %-5zu heap %8.2f ms  pheap %8.2f ms\n", n, s,
+            th * 1e3 / (double) rounds, tp * 1e3 / (double) rounds);
+}
+
+int main(int argc, char **argv) {
+    size_t n = argc > 1 ? strtoul(argv[1], null, 10) : 1000000;
+    size_t s = argc > 2 ? strtoul(argv[2], null, 10) : 1000;
+    size_t i;
+
+    uint64_t *keys;
+    if ((keys = malloc(n * sizeof(uint64_t))) == null) {
+        return 1;
+    }
+    uint64_t x = 88172645463325252u;
+    for (i = 0; i < n; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        keys[i] = x;
+    }
+
+    push_heavy(keys, n);
+    merge_heavy(keys, n, s);
+    free(keys);
+
+    return 0;
+}
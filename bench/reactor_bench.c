@@ -0,0 +1,150 @@
+// pipe throughput through the reactor against a poll loop that hands every readiness event over with tp_add
+// build from the repo root: cc -std=gnu11 -O2 -I. bench/reactor_bench.c reactor.c threadpool.c kheap.c -lpthread
+// usage: ./a.out [pipes] [messages]
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "reactor.h"
+
+#define MSG 64
+
+static size_t num_pipes;
+static size_t num_msgs;
+static int (*fds)[2];
+static atomic_size_t got;
+static atomic_bool polling;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+// write 'num_msgs' messages round-robin over the pipes, retrying while a pipe is full
+static void *writer(void *arg) {
+    char buf[MSG] = {0};
+    size_t i;
+    for (i = 0; i < num_msgs; i++) {
+        int fd = fds[i % num_pipes][1];
+        while (write(fd, buf, MSG) != MSG) {
+            sched_yield();
+        }
+    }
+    return arg;
+}
+
+// drain a pipe until EAGAIN, as an edge-triggered callback must
+static void drain(int fd) {
+    char buf[64 * MSG];
+    ssize_t k;
+    while ((k = read(fd, buf, sizeof(buf))) > 0) {
+        atomic_fetch_add(&got, (size_t) k / MSG);
+    }
+}
+
+static void *on_read(int fd, int events, void *arg) {
+    (void) events;
+    drain(fd);
+    return arg;
+}
+
+static void *count(void *arg) {
+    atomic_fetch_add(&got, (size_t) arg / MSG);
+    return null;
+}
+
+// the hand-rolled loop: poll every pipe, read what is there and queue one task per readiness event
+static void *poller(void *arg) {
+    threadpool *pool = (threadpool *) arg;
+    struct pollfd *ps = malloc(num_pipes * sizeof(struct pollfd));
+    char buf[64 * MSG];
+    size_t i;
+    for (i = 0; i < num_pipes; i++) {
+        ps[i].fd = fds[i][0];
+        ps[i].events = POLLIN;
+    }
+    while (atomic_load(&polling)) {
+        if (poll(ps, num_pipes, 10) <= 0) {
+            continue;
+        }
+        for (i = 0; i < num_pipes; i++) {
+            ssize_t k;
+            if ((ps[i].revents & POLLIN) && (k = read(ps[i].fd, buf, sizeof(buf))) > 0) {
+                tp_add(pool, count, (void *) (size_t) k, 0);
+            }
+        }
+    }
+    free(ps);
+    return null;
+}
+
+static void open_pipes(void) {
+    size_t i;
+    for (i = 0; i < num_pipes; i++) {
+        if (pipe(fds[i]) != 0) {
+            perror("pipe");
+            exit(1);
+        }
+        fcntl(fds[i][0], F_SETFL, O_NONBLOCK);
+        fcntl(fds[i][1], F_SETFL, O_NONBLOCK);
+    }
+}
+
+static void close_pipes(void) {
+    size_t i;
+    for (i = 0; i < num_pipes; i++) {
+        close(fds[i][0]);
+        close(fds[i][1]);
+    }
+}
+
+// run the writer and wait until every message has been counted
+static double pump(void) {
+    pthread_t w;
+    double t = now();
+    atomic_store(&got, 0);
+    pthread_create(&w, null, writer, null);
+    while (atomic_load(&got) < num_msgs) {
+        sched_yield();
+    }
+    pthread_join(w, null);
+    return now() - t;
+}
+
+int main(int argc, char **argv) {
+    num_pipes = argc > 1 ? strtoul(argv[1], null, 10) : 64;
+    num_msgs = argc > 2 ? strtoul(argv[2], null, 10) : 1000000;
+    fds = malloc(num_pipes * sizeof(*fds));
+    size_t i;
+
+    threadpool *pool = tp_init(4);
+    open_pipes();
+    reactor *r = rt_init(pool);
+    for (i = 0; i < num_pipes; i++) {
+        rt_add(r, fds[i][0], rtev_read, on_read, null, 0);
+    }
+    double t = pump();
+    printf("reactor     %zu pipes %8.0f msgs/s\n", num_pipes, (double) num_msgs / t);
+    rt_dest(r, tpsdown_soft);
+    close_pipes();
+
+    open_pipes();
+    pthread_t p;
+    atomic_store(&polling, true);
+    pthread_create(&p, null, poller, pool);
+    t = pump();
+    printf("poll+tp_add %zu pipes %8.0f msgs/s\n", num_pipes, (double) num_msgs / t);
+    atomic_store(&polling, false);
+    pthread_join(p, null);
+    close_pipes();
+
+    tp_dest(pool, tpexit_graceful);
+    free(fds);
+
+    return 0;
+}
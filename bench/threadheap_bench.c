@@ -0,0 +1,107 @@
+// throughput of threadheap against a heap behind one mutex as threads are added
+// build from the repo root: cc -std=gnu11 -O2 -I. bench/threadheap_bench.c threadheap.c heap.c -lpthread
+// usage: ./a.out [ops per thread] [max threads]
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "heap.h"
+#include "threadheap.h"
+
+#define PREFILL 100000
+
+static size_t ops;
+static uint64_t *keys;
+static size_t num_keys;
+
+static threadheap *th;
+static heap *mh;
+static pthread_mutex_t mh_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool lt(void const *a, void const *b) {
+    return *(uint64_t const *) a < *(uint64_t const *) b;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+// alternate pushes and pops so the size stays near the prefill
+static void *run_thheap(void *arg) {
+    size_t i, off = (size_t) arg;
+    for (i = 0; i < ops; i++) {
+        if (i & 1) {
+            thheap_pop(th);
+        } else {
+            thheap_push(th, &keys[(off + i) % num_keys]);
+        }
+    }
+    return null;
+}
+
+static void *run_locked(void *arg) {
+    size_t i, off = (size_t) arg;
+    for (i = 0; i < ops; i++) {
+        pthread_mutex_lock(&mh_lock);
+        if (i & 1) {
+            h_pop(mh);
+        } else {
+            h_push(mh, &keys[(off + i) % num_keys]);
+        }
+        pthread_mutex_unlock(&mh_lock);
+    }
+    return null;
+}
+
+// start 'k' threads on 'body' and return the total operations per second
+static double spawn(size_t k, void *(*body)(void *)) {
+    pthread_t ts[k];
+    size_t i;
+    double t = now();
+    for (i = 0; i < k; i++) {
+        pthread_create(&ts[i], null, body, (void *) (i * ops));
+    }
+    for (i = 0; i < k; i++) {
+        pthread_join(ts[i], null);
+    }
+    return (double) (k * ops) / (now() - t);
+}
+
+int main(int argc, char **argv) {
+    ops = argc > 1 ? strtoul(argv[1], null, 10) : 1000000;
+    size_t k, i, max_ts = argc > 2 ? strtoul(argv[2], null, 10) : 8;
+
+    num_keys = PREFILL + max_ts * ops;
+    if ((keys = malloc(num_keys * sizeof(uint64_t))) == null) {
+        return 1;
+    }
+    uint64_t x = 88172645463325252u;
+    for (i = 0; i < num_keys; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        keys[i] = x;
+    }
+
+    for (k = 1; k <= max_ts; k *= 2) {
+        th = thheap_init(PREFILL, 0, lt);
+        mh = h_init(PREFILL, lt);
+        for (i = 0; i < PREFILL; i++) {
+            thheap_push(th, &keys[num_keys - 1 - i]);
+            h_push(mh, &keys[num_keys - 1 - i]);
+        }
+
+        double a = spawn(k, run_thheap);
+        double b = spawn(k, run_locked);
+        printf("threads %-3zu threadheap %7.2f Mops/s  mutex heap %7.2f Mops/s\n", k, a / 1e6, b / 1e6);
+
+        thheap_free(th);
+        h_free(mh);
+    }
+    free(keys);
+
+    return 0;
+}
@@ -0,0 +1,53 @@
+// task start latency of an idle pool, with workers that park at once and with workers that spin first
+// build from the repo root: cc -std=gnu11 -O2 -I. bench/tp_latency_bench.c threadpool.c kheap.c -lpthread
+// usage: ./a.out [tasks] [gap_us] [spin_us]
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "threadpool.h"
+
+static void *nop(void *arg) {
+    return arg;
+}
+
+// submit 'n' empty tasks 'gap_us' apart so the workers go idle between them, then read the start latencies
+static void run(size_t n, unsigned gap_us, unsigned spin_us) {
+    tp_opts opts = {0};
+    opts.num_ts = 4;
+    opts.spin_us = spin_us;
+    opts.stats = true;
+
+    threadpool *pool;
+    if ((pool = tp_init_opts(&opts)) == null) {
+        fprintf(stderr, "tp_init_opts failed\n");
+        exit(1);
+    }
+
+    struct timespec gap = {0, (long) gap_us * 1000};
+    size_t i;
+    for (i = 0; i < n; i++) {
+        tp_add(pool, nop, null, 0);
+        nanosleep(&gap, null);
+    }
+
+    tp_stats_t st;
+    tp_stats(pool, &st);
+    printf("spin_us %-6u p50 %8.1f us  p90 %8.1f us  p99 %8.1f us  wakeups %zu\n", spin_us,
+            tp_hist_quantile(st.wait_hist, 0.50) / 1e3,
+            tp_hist_quantile(st.wait_hist, 0.90) / 1e3,
+            tp_hist_quantile(st.wait_hist, 0.99) / 1e3, st.wakeups);
+
+    tp_dest(pool, tpexit_graceful);
+}
+
+int main(int argc, char **argv) {
+    size_t n = argc > 1 ? strtoul(argv[1], null, 10) : 20000;
+    unsigned gap_us = argc > 2 ? (unsigned) strtoul(argv[2], null, 10) : 50;
+    unsigned spin_us = argc > 3 ? (unsigned) strtoul(argv[3], null, 10) : 200;
+
+    printf("%zu tasks, %u us apart\n", n, gap_us);
+    run(n, gap_us, 0);
+    run(n, gap_us, spin_us);
+
+    return 0;
+}
@@ -2,6 +2,11 @@
 #include <stdlib.h>
 #include <string.h>
 
+#define BSA_CACHE_LINE 64
+
+// searches bsa_has_many runs side by side
+#define BSA_LANES 8
+
 struct bsa {
     const int8_t t;
     size_t n;
@@ -10,8 +15,122 @@ struct bsa {
     int (*cmp)(const void_ptr , const void_ptr);
 
     void_ptr *as;
+
+    // 'as' in Eytzinger order from index 1 while frozen, null otherwise
+    void_ptr *eyt;
 };
 
+// index of the first item not less than 'a', or greater than 'a' when 'upper' is set
+static size_t bsa_bound(bsa *b, void_ptr a, bool upper) {
+    size_t m = 0, n = b->n;
+    while (m < n) {
+        size_t i = (m + n) / 2;
+        int cmp = b->cmp(a, b->as[i]);
+        if (cmp > 0 || (upper && cmp == 0)) {
+            m = i + 1;
+        } else {
+            n = i;
+        }
+    }
+    return m;
+}
+
+// drop the frozen layout, it goes stale as soon as the items change
+static void bsa_thaw(bsa *b) {
+    free(b->eyt);
+    b->eyt = null;
+}
+
+// lay the sorted items from 'i' out as the subtree rooted at 'k', returns the next unplaced item
+static size_t bsa_eytz(bsa *b, size_t i, size_t k) {
+    if (k <= b->n) {
+        i = bsa_eytz(b, i, 2 * k);
+        b->eyt[k] = b->as[i++];
+        i = bsa_eytz(b, i, 2 * k + 1);
+    }
+    return i;
+}
+
+// one level down the frozen layout, prefetching the line that holds all eight descendants three levels on
+// the copy is cache-line aligned, so with 8-byte entries those eight fill exactly one line
+static size_t bsa_step(bsa *b, size_t k, void_ptr a) {
+    size_t p = k << 3;
+    __builtin_prefetch(&b->eyt[p <= b->n ? p : 0]);
+    return 2 * k + (b->cmp(b->eyt[k], a) < 0);
+}
+
+// whether the walk that ended at 'k' found an item equal to 'a'
+static bool bsa_found(bsa *b, size_t k, void_ptr a) {
+    // strip the trailing right turns and the last left one to get the lower bound
+    k >>= __builtin_ffsl((long) ~k);
+    return k != 0 && b->cmp(b->eyt[k], a) == 0;
+}
+
+// grow the array so 'k' more items fit
+static bool bsa_reserve(bsa *b, size_t k) {
+    if (b->n + k < b->m) {
+        return true;
+    }
+
+    size_t new_n = b->m << 2;
+    while (new_n <= b->n + k) {
+        new_n <<= 2;
+    }
+    void_ptr *new_as;
+    if ((new_as = malloc(new_n * sizeof(void_ptr))) == null) {
+        return false;
+    }
+    memcpy(new_as, b->as, b->n * sizeof(void_ptr));
+    free(b->as);
+    b->as = new_as;
+    b->m = new_n;
+
+    return true;
+}
+
+// stable merge sort of 'n' items using 'tmp' as scratch of the same size
+static void bsa_sort(bsa *b, void_ptr *as, void_ptr *tmp, size_t n) {
+    size_t i, j, k;
+    if (n <= 16) {
+        for (i = 1; i < n; i++) {
+            void_ptr a = as[i];
+            for (j = i; j > 0 && b->cmp(as[j - 1], a) > 0; j--) {
+                as[j] = as[j - 1];
+            }
+            as[j] = a;
+        }
+        return;
+    }
+
+    size_t h = n / 2;
+    bsa_sort(b, as, tmp, h);
+    bsa_sort(b, as + h, tmp, n - h);
+
+    // already in order, which makes sorted input linear
+    if (b->cmp(as[h - 1], as[h]) <= 0) {
+        return;
+    }
+
+    memcpy(tmp, as, h * sizeof(void_ptr));
+    for (i = 0, j = h, k = 0; i < h; k++) {
+        as[k] = j < n && b->cmp(as[j], tmp[i]) < 0 ? as[j++] : tmp[i++];
+    }
+}
+
+// merge 'k' sorted items into the items from the back, room for them must be reserved
+// equal items from 'as' land after the ones already there, as with 'k' pushes
+static void bsa_merge_in(bsa *b, void_ptr const *as, size_t k) {
+    size_t i = b->n, j = k, w = b->n + k;
+    while (j > 0) {
+        if (i > 0 && b->cmp(b->as[i - 1], as[j - 1]) > 0) {
+            b->as[--w] = b->as[--i];
+        } else {
+            b->as[--w] = as[--j];
+        }
+    }
+    b->n += k;
+}
+
 bsa *bsa_init(int (*cmp)(const void_ptr , const void_ptr)) {
     bsa *b = malloc(sizeof(bsa));
     *((int8_t *) b) = 1;
@@ -19,53 +138,67 @@ bsa *bsa_init(int (*cmp)(const void_ptr , const void_ptr)) {
     b->n = 0;
     b->cmp = cmp;
     b->as = malloc(b->m * sizeof(void_ptr));
+    b->eyt = null;
 
     return b;
 }
 
+void bsa_free(bsa *b) {
+    free(b->eyt);
+    free(b->as);
+    free(b);
+}
+
 bool bsa_push(bsa *b, void_ptr a) {
-    b->n++;
-    if (b->n == b->m) {
-        size_t new_n = b->m << 2;
-        void_ptr *new_as;
-        if ((new_as = malloc(new_n * sizeof(void_ptr))) == null) {
-            return false;
-        }
-        memcpy(new_as, b->as, b->m * sizeof(void_ptr));
-        free(b->as);
-        b->as = new_as;
-        b->m = new_n;
+    if (!bsa_reserve(b, 1)) {
+        return false;
     }
+    bsa_thaw(b);
 
-    size_t n = b->n - 1;
-    size_t m = 0;
+    // equal items keep the order they were pushed in
+    size_t i = bsa_bound(b, a, true);
+    memmove(&b->as[i + 1], &b->as[i], (b->n - i) * sizeof(void_ptr));
+    b->as[i] = a;
+    b->n++;
 
-    size_t i = 0;
-    while (m < n) {
-        i = (m + n) / 2;
-        int cmp = b->cmp(a, b->as[i]);
-        if (cmp < 0) {
-            n = i - 1;
-        } else if (cmp > 0) {
-            m = i + 1;
-        } else {
-            break;
-        }
+    return true;
+}
+
+bool bsa_push_many(bsa *b, void_ptr const *as, size_t k) {
+    if (k == 0) {
+        return true;
     }
 
-    memmove(&b->as[i + 1], &b->as[i], (b->n - i) * sizeof(void_ptr));
-    b->as[i] = a;
+    // sort a copy of the batch, then one pass merges it in
+    void_ptr *batch;
+    if (as == null || !bsa_reserve(b, k) || (batch = malloc(2 * k * sizeof(void_ptr))) == null) {
+        return false;
+    }
+    memcpy(batch, as, k * sizeof(void_ptr));
+    bsa_sort(b, batch, batch + k, k);
+    bsa_thaw(b);
+    bsa_merge_in(b, batch, k);
+    free(batch);
 
     return true;
 }
 
-void_ptr bsa_pop(bsa *b) {
-    return b->n > 0 ? b->as[0] : null;
+bool bsa_merge(bsa *dest, bsa *src) {
+    if (dest == null || src == null || dest == src || !bsa_reserve(dest, src->n)) {
+        return false;
+    }
+
+    bsa_thaw(dest);
+    bsa_merge_in(dest, src->as, src->n);
+    bsa_free(src);
+
+    return true;
 }
 
-void_ptr bsa_peek(bsa *b) {
+void_ptr bsa_pop(bsa *b) {
     void_ptr a = null;
     if (b->n > 0) {
+        bsa_thaw(b);
         b->n--;
         a = b->as[0];
         memmove(&b->as[0], &b->as[1], b->n * sizeof(void_ptr));
@@ -74,24 +207,104 @@ void_ptr bsa_peek(bsa *b) {
     return a;
 }
 
+void_ptr bsa_peek(bsa *b) {
+    return b->n > 0 ? b->as[0] : null;
+}
+
 bool bsa_has(bsa *b, void_ptr a) {
-    size_t n = b->n - 1;
-    size_t m = 0;
+    if (b->eyt != null) {
+        size_t k = 1;
+        while (k <= b->n) {
+            k = bsa_step(b, k, a);
+        }
+        return bsa_found(b, k, a);
+    }
 
-    size_t i = 0;
-    while (m < n) {
-        i = (m + n) / 2;
-        int cmp = b->cmp(a, b->as[i]);
-        if (cmp < 0) {
-            n = i - 1;
-        } else if (cmp > 0) {
-            m = i + 1;
-        } else {
-            return true;
+    size_t i = bsa_bound(b, a, false);
+    return i < b->n && b->cmp(a, b->as[i]) == 0;
+}
+
+size_t bsa_has_many(bsa *b, void_ptr const *as, size_t k, bool *found) {
+    size_t i, j, c = 0;
+    if (b->eyt == null) {
+        for (i = 0; i < k; i++) {
+            c += (found[i] = bsa_has(b, as[i]));
         }
+        return c;
+    }
+
+    // every walk takes one step per level, so a group of them moves in lockstep
+    // and each lane's next node is being fetched while the others compare
+    size_t depth = 0;
+    while (((size_t) 1 << depth) <= b->n) {
+        depth++;
+    }
+    for (i = 0; i < k; i += BSA_LANES) {
+        size_t d, lanes = k - i < BSA_LANES ? k - i : BSA_LANES;
+        size_t ks[BSA_LANES];
+        for (j = 0; j < lanes; j++) {
+            ks[j] = 1;
+        }
+        for (d = 0; d < depth; d++) {
+            for (j = 0; j < lanes; j++) {
+                if (ks[j] <= b->n) {
+                    ks[j] = bsa_step(b, ks[j], as[i + j]);
+                }
+            }
+        }
+        for (j = 0; j < lanes; j++) {
+            c += (found[i + j] = bsa_found(b, ks[j], as[i + j]));
+        }
+    }
+
+    return c;
+}
+
+bool bsa_freeze(bsa *b) {
+    if (b->eyt != null) {
+        return true;
+    }
+
+    if ((b->eyt = aligned_alloc(BSA_CACHE_LINE, ((b->n + 1) * sizeof(void_ptr) + BSA_CACHE_LINE - 1)
+            / BSA_CACHE_LINE * BSA_CACHE_LINE)) == null) {
+        return false;
+    }
+    b->eyt[0] = null;
+    bsa_eytz(b, 0, 1);
+
+    return true;
+}
+
+bsa_cursor bsa_lower_bound(bsa *b, void_ptr a) {
+    bsa_cursor c = {b, bsa_bound(b, a, false), b->n};
+    return c;
+}
+
+bsa_cursor bsa_upper_bound(bsa *b, void_ptr a) {
+    bsa_cursor c = {b, bsa_bound(b, a, true), b->n};
+    return c;
+}
+
+bsa_cursor bsa_slice(bsa *b, void_ptr lo, void_ptr hi) {
+    bsa_cursor c = {b, bsa_bound(b, lo, false), bsa_bound(b, hi, true)};
+    // 'hi' below 'lo' is an empty slice
+    if (c.end < c.i) {
+        c.end = c.i;
+    }
+    return c;
+}
+
+void_ptr bsa_next(bsa_cursor *c) {
+    return c->i < c->end ? c->b->as[c->i++] : null;
+}
+
+size_t bsa_range(bsa *b, void_ptr lo, void_ptr hi, bool (*func)(void_ptr)) {
+    bsa_cursor c = bsa_slice(b, lo, hi);
+    size_t start = c.i;
+    while (c.i < c.end && (func)(b->as[c.i++])) {
     }
 
-    return false;
+    return c.i - start;
 }
 
 bool bsa_empty(bsa *b) {
@@ -100,6 +313,7 @@ bool bsa_empty(bsa *b) {
 
 void bsa_foreach(bsa *b, void_ptr (*func)(void_ptr)) {
     size_t i;
+    bsa_thaw(b);
     for (i = 0; i < b->n; i++) {
         b->as[i] = (func)(b->as[i]);
     }
@@ -107,6 +321,7 @@ void bsa_foreach(bsa *b, void_ptr (*func)(void_ptr)) {
 
 size_t bsa_reduce(bsa *b, bool (*func)(void_ptr)) {
     size_t i, c = 0;
+    bsa_thaw(b);
     for (i = 0; i < b->n && (func)(b->as[i]); i++, c++) {
     }
 
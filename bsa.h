@@ -6,12 +6,30 @@
 
 typedef struct bsa bsa;
 
+// a slice of the sorted items, items i up to but not including end; streamed with bsa_next
+// NOTE: any change to the bsa invalidates its cursors
+typedef struct {
+    bsa *b;
+    size_t i;
+    size_t end;
+} bsa_cursor;
+
 // initialize the bsa (binary search array)
 extern bsa *bsa_init(int (*cmp)(const void_ptr , const void_ptr));
 
+// free the memory used directly by the bsa
+extern void bsa_free(bsa *b);
+
 // insert an item into the bsa
 extern bool bsa_push(bsa *b, void_ptr a);
 
+// insert 'k' items with one sort of the batch and one linear merge, O(n + k log k)
+extern bool bsa_push_many(bsa *b, void_ptr const *as, size_t k);
+
+// merge the items of the src bsa into the dest bsa in one linear pass, both must share the comparison function
+// NOTE: src is consumed in this operation
+extern bool bsa_merge(bsa *dest, bsa *src);
+
 // remove and return the least item out of the tree
 extern void_ptr bsa_pop(bsa *b);
 
@@ -21,6 +39,30 @@ extern void_ptr bsa_peek(bsa *b);
 // returns whether the tree has the item
 extern bool bsa_has(bsa *b, void_ptr a);
 
+// look up 'k' items at once, interleaving the searches to overlap their cache misses
+// sets found[i] for each item and returns how many were found
+extern size_t bsa_has_many(bsa *b, void_ptr const *as, size_t k, bool *found);
+
+// keep a copy of the items in Eytzinger order so bsa_has and bsa_has_many search it branch-free
+// and with prefetching; any change to the items drops the copy until the next freeze
+extern bool bsa_freeze(bsa *b);
+
+// cursor from the first item not less than 'a' to the end, O(log n)
+extern bsa_cursor bsa_lower_bound(bsa *b, void_ptr a);
+
+// cursor from the first item greater than 'a' to the end, O(log n)
+extern bsa_cursor bsa_upper_bound(bsa *b, void_ptr a);
+
+// cursor over the items between 'lo' and 'hi' inclusive, O(log n)
+extern bsa_cursor bsa_slice(bsa *b, void_ptr lo, void_ptr hi);
+
+// return the cursor's next item and advance it, null once the slice is used up
+extern void_ptr bsa_next(bsa_cursor *c);
+
+// applies the function to the items between 'lo' and 'hi' inclusive in order until it returns false,
+// returns how many items it was applied to, O(log n + k)
+extern size_t bsa_range(bsa *b, void_ptr lo, void_ptr hi, bool (*func)(void_ptr));
+
 // returns whether the tree is empty
 extern bool bsa_empty(bsa *b);
 
@@ -0,0 +1,467 @@
+#include "bst.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BST_CACHE_LINE 64
+
+// a node spans four cache lines, a leaf holds BST_LEAF items and an inner node BST_FANOUT children
+#define BST_NODE_BYTES (4 * BST_CACHE_LINE)
+#define BST_LEAF ((BST_NODE_BYTES - 2 * sizeof(void_ptr)) / sizeof(void_ptr))
+#define BST_FANOUT (BST_NODE_BYTES / (2 * sizeof(void_ptr)))
+
+// deeper than any tree that fits in memory
+#define BST_MAX_DEPTH 32
+
+// separator i of an inner node is no greater than anything under child i + 1 and no less than anything
+// under child i; nodes are not merged when they shrink, only dropped once empty, so leaves stay level
+typedef struct bst_node bst_node;
+struct bst_node {
+    // items in a leaf, children in an inner node
+    uint32_t n;
+    bool leaf;
+    union {
+        struct {
+            bst_node *next;
+            void_ptr as[BST_LEAF];
+        } l;
+        struct {
+            void_ptr as[BST_FANOUT - 1];
+            bst_node *cs[BST_FANOUT];
+        } i;
+    };
+};
+
+struct bst {
+    const int8_t t;
+    size_t n;
+
+    int (*cmp)(const void_ptr , const void_ptr);
+
+    // null while empty, 'head' is the leftmost leaf and the start of the leaf chain
+    bst_node *root;
+    bst_node *head;
+};
+
+static bst_node *bst_node_new(bool leaf) {
+    bst_node *x;
+    if ((x = aligned_alloc(BST_CACHE_LINE, sizeof(bst_node))) == null) {
+        return null;
+    }
+
+    x->n = 0;
+    x->leaf = leaf;
+    if (leaf) {
+        x->l.next = null;
+    }
+    return x;
+}
+
+static void bst_node_free(bst_node *x) {
+    if (!x->leaf) {
+        size_t i;
+        for (i = 0; i < x->n; i++) {
+            bst_node_free(x->i.cs[i]);
+        }
+    }
+    free(x);
+}
+
+// index of the first of the 'n' items greater than 'a'
+static size_t bst_upper(bst *b, void_ptr const *as, size_t n, void_ptr a) {
+    size_t m = 0;
+    while (m < n) {
+        size_t i = (m + n) / 2;
+        if (b->cmp(a, as[i]) < 0) {
+            n = i;
+        } else {
+            m = i + 1;
+        }
+    }
+    return m;
+}
+
+// index of the first of the 'n' items not less than 'a'
+static size_t bst_lower(bst *b, void_ptr const *as, size_t n, void_ptr a) {
+    size_t m = 0;
+    while (m < n) {
+        size_t i = (m + n) / 2;
+        if (b->cmp(a, as[i]) > 0) {
+            m = i + 1;
+        } else {
+            n = i;
+        }
+    }
+    return m;
+}
+
+// least item under a node
+static void_ptr bst_low(bst_node *x) {
+    while (!x->leaf) {
+        x = x->i.cs[0];
+    }
+    return x->l.as[0];
+}
+
+// replace a root with a single child by that child
+static void bst_shrink(bst *b) {
+    while (b->root != null && !b->root->leaf && b->root->n == 1) {
+        bst_node *old = b->root;
+        b->root = old->i.cs[0];
+        free(old);
+    }
+}
+
+// stack inner nodes over the 'k' nodes of a level until one is left, spreading children evenly
+// on failure every node of 'level' and above is freed and null returned
+static bst_node *bst_build(bst_node **level, size_t k) {
+    while (k > 1) {
+        size_t j, c = 0, m = (k + BST_FANOUT - 1) / BST_FANOUT;
+        for (j = 0; j < m; j++) {
+            size_t i, num = k / m + (j < k % m);
+            bst_node *x;
+            if ((x = bst_node_new(false)) == null) {
+                // the new level owns what it took, the rest of the old level is still loose
+                for (i = 0; i < j; i++) {
+                    bst_node_free(level[i]);
+                }
+                for (i = c; i < k; i++) {
+                    bst_node_free(level[i]);
+                }
+                return null;
+            }
+            for (i = 0; i < num; i++) {
+                x->i.cs[i] = level[c + i];
+                if (i > 0) {
+                    x->i.as[i - 1] = bst_low(level[c + i]);
+                }
+            }
+            x->n = (uint32_t) num;
+            c += num;
+            level[j] = x;
+        }
+        k = m;
+    }
+    return level[0];
+}
+
+bst *bst_init(int (*cmp)(const void_ptr , const void_ptr)) {
+    bst *b;
+    if ((b = malloc(sizeof(bst))) == null) {
+        return null;
+    }
+
+    *((int8_t *) b) = 4;
+    b->n = 0;
+    b->cmp = cmp;
+    b->root = null;
+    b->head = null;
+
+    return b;
+}
+
+bst *bst_load(int (*cmp)(const void_ptr , const void_ptr), void_ptr const *as, size_t n) {
+    size_t i, j;
+    if (as == null && n > 0) {
+        return null;
+    }
+    for (i = 1; i < n; i++) {
+        if (cmp(as[i - 1], as[i]) > 0) {
+            return null;
+        }
+    }
+
+    bst *b;
+    if ((b = bst_init(cmp)) == null || n == 0) {
+        return b;
+    }
+
+    // full leaves would split on the next push into them, so spread the items evenly instead
+    size_t k = (n + BST_LEAF - 1) / BST_LEAF, c = 0;
+    bst_node **level;
+    if ((level = malloc(k * sizeof(bst_node *))) == null) {
+        free(b);
+        return null;
+    }
+    for (j = 0; j < k; j++) {
+        size_t num = n / k + (j < n % k);
+        if ((level[j] = bst_node_new(true)) == null) {
+            for (i = 0; i < j; i++) {
+                free(level[i]);
+            }
+            free(level);
+            free(b);
+            return null;
+        }
+        memcpy(level[j]->l.as, as + c, num * sizeof(void_ptr));
+        level[j]->n = (uint32_t) num;
+        if (j > 0) {
+            level[j - 1]->l.next = level[j];
+        }
+        c += num;
+    }
+    b->head = level[0];
+
+    if ((b->root = bst_build(level, k)) == null) {
+        free(level);
+        free(b);
+        return null;
+    }
+    b->n = n;
+    free(level);
+
+    return b;
+}
+
+void bst_free(bst *b) {
+    if (b->root != null) {
+        bst_node_free(b->root);
+    }
+    free(b);
+}
+
+bool bst_push(bst *b, void_ptr a) {
+    if (b->root == null) {
+        if ((b->root = b->head = bst_node_new(true)) == null) {
+            return false;
+        }
+    }
+
+    // walk down to the leaf, remembering the way back up
+    bst_node *path[BST_MAX_DEPTH];
+    size_t idx[BST_MAX_DEPTH];
+    size_t d = 0;
+    bst_node *x = b->root;
+    while (!x->leaf) {
+        path[d] = x;
+        idx[d] = bst_upper(b, x->i.as, x->n - 1, a);
+        x = x->i.cs[idx[d++]];
+    }
+
+    size_t pos = bst_upper(b, x->l.as, x->n, a);
+    if (x->n < BST_LEAF) {
+        memmove(&x->l.as[pos + 1], &x->l.as[pos], (x->n - pos) * sizeof(void_ptr));
+        x->l.as[pos] = a;
+        x->n++;
+        b->n++;
+        return true;
+    }
+
+    // a split runs up through every full ancestor, allocate it all first so it can't fail halfway
+    bst_node *spare[BST_MAX_DEPTH + 2];
+    size_t need = 1, got;
+    while (need <= d && path[d - need]->n == BST_FANOUT) {
+        need++;
+    }
+    need += need > d;
+    for (got = 0; got < need; got++) {
+        if ((spare[got] = bst_node_new(got == 0)) == null) {
+            while (got-- > 0) {
+                free(spare[got]);
+            }
+            return false;
+        }
+    }
+
+    // split the leaf in half and put the item on its side
+    size_t half = BST_LEAF / 2;
+    bst_node *right = spare[0];
+    memcpy(right->l.as, &x->l.as[half], (BST_LEAF - half) * sizeof(void_ptr));
+    right->n = (uint32_t) (BST_LEAF - half);
+    x->n = (uint32_t) half;
+    bst_node *into = pos <= half ? x : right;
+    pos = pos <= half ? pos : pos - half;
+    memmove(&into->l.as[pos + 1], &into->l.as[pos], (into->n - pos) * sizeof(void_ptr));
+    into->l.as[pos] = a;
+    into->n++;
+    right->l.next = x->l.next;
+    x->l.next = right;
+    b->n++;
+
+    // hand the separator and new node up until a parent has room
+    void_ptr sep = right->l.as[0];
+    bst_node *child = right;
+    size_t s = 1;
+    while (d > 0) {
+        bst_node *p = path[--d];
+        size_t i = idx[d];
+        if (p->n < BST_FANOUT) {
+            memmove(&p->i.as[i + 1], &p->i.as[i], (p->n - 1 - i) * sizeof(void_ptr));
+            memmove(&p->i.cs[i + 2], &p->i.cs[i + 1], (p->n - 1 - i) * sizeof(bst_node *));
+            p->i.as[i] = sep;
+            p->i.cs[i + 1] = child;
+            p->n++;
+            return true;
+        }
+
+        // lay out all children and separators with the new one, then split them in two
+        void_ptr seps[BST_FANOUT];
+        bst_node *cs[BST_FANOUT + 1];
+        memcpy(seps, p->i.as, i * sizeof(void_ptr));
+        seps[i] = sep;
+        memcpy(&seps[i + 1], &p->i.as[i], (BST_FANOUT - 1 - i) * sizeof(void_ptr));
+        memcpy(cs, p->i.cs, (i + 1) * sizeof(bst_node *));
+        cs[i + 1] = child;
+        memcpy(&cs[i + 2], &p->i.cs[i + 1], (BST_FANOUT - 1 - i) * sizeof(bst_node *));
+
+        size_t lc = (BST_FANOUT + 1) / 2;
+        bst_node *q = spare[s++];
+        memcpy(p->i.as, seps, (lc - 1) * sizeof(void_ptr));
+        memcpy(p->i.cs, cs, lc * sizeof(bst_node *));
+        p->n = (uint32_t) lc;
+        memcpy(q->i.as, &seps[lc], (BST_FANOUT - lc) * sizeof(void_ptr));
+        memcpy(q->i.cs, &cs[lc], (BST_FANOUT + 1 - lc) * sizeof(bst_node *));
+        q->n = (uint32_t) (BST_FANOUT + 1 - lc);
+
+        sep = seps[lc - 1];
+        child = q;
+    }
+
+    // the root split, grow a new one above it
+    bst_node *r = spare[s];
+    r->i.as[0] = sep;
+    r->i.cs[0] = b->root;
+    r->i.cs[1] = child;
+    r->n = 2;
+    b->root = r;
+
+    return true;
+}
+
+void_ptr bst_pop(bst *b) {
+    if (b->root == null) {
+        return null;
+    }
+
+    bst_node *x = b->head;
+    void_ptr a = x->l.as[0];
+    memmove(&x->l.as[0], &x->l.as[1], (x->n - 1) * sizeof(void_ptr));
+    x->n--;
+    b->n--;
+    if (x->n > 0) {
+        return a;
+    }
+
+    // the leftmost leaf emptied, drop it and every ancestor it leaves empty
+    bst_node *path[BST_MAX_DEPTH];
+    size_t d = 0;
+    bst_node *y = b->root;
+    while (!y->leaf) {
+        path[d++] = y;
+        y = y->i.cs[0];
+    }
+    b->head = x->l.next;
+    free(x);
+    while (d > 0) {
+        bst_node *p = path[--d];
+        if (--p->n > 0) {
+            memmove(&p->i.as[0], &p->i.as[1], (p->n - 1) * sizeof(void_ptr));
+            memmove(&p->i.cs[0], &p->i.cs[1], p->n * sizeof(bst_node *));
+            bst_shrink(b);
+            return a;
+        }
+        free(p);
+    }
+    b->root = null;
+
+    return a;
+}
+
+void_ptr bst_peek(bst *b) {
+    return b->head == null ? null : b->head->l.as[0];
+}
+
+bool bst_has(bst *b, void_ptr a) {
+    if (b->root == null) {
+        return false;
+    }
+
+    // go to the leftmost leaf that could hold an equal item, duplicates may run on into the next leaves
+    bst_node *x = b->root;
+    while (!x->leaf) {
+        x = x->i.cs[bst_lower(b, x->i.as, x->n - 1, a)];
+    }
+    for (; x != null; x = x->l.next) {
+        size_t i = bst_lower(b, x->l.as, x->n, a);
+        if (i < x->n) {
+            return b->cmp(a, x->l.as[i]) == 0;
+        }
+    }
+
+    return false;
+}
+
+bool bst_empty(bst *b) {
+    return b->n == 0;
+}
+
+size_t bst_size(bst *b) {
+    return b->n;
+}
+
+void bst_foreach(bst *b, void_ptr (*func)(void_ptr)) {
+    bst_node *x;
+    size_t i;
+    for (x = b->head; x != null; x = x->l.next) {
+        for (i = 0; i < x->n; i++) {
+            x->l.as[i] = (func)(x->l.as[i]);
+        }
+    }
+}
+
+// filter the items under a node, relinking the surviving leaves after 'last'; returns what the node keeps
+static size_t bst_reduce_node(bst *b, bst_node *x, bool (*func)(void_ptr), bst_node **last) {
+    size_t i, c = 0;
+    if (x->leaf) {
+        for (i = 0; i < x->n; i++) {
+            if ((func)(x->l.as[i])) {
+                x->l.as[c++] = x->l.as[i];
+            }
+        }
+        x->n = (uint32_t) c;
+        b->n += c;
+        if (c > 0) {
+            if (*last == null) {
+                b->head = x;
+            } else {
+                (*last)->l.next = x;
+            }
+            *last = x;
+        }
+        return c;
+    }
+
+    // a kept child keeps the separator on its left, which still bounds the children around it
+    for (i = 0; i < x->n; i++) {
+        bst_node *y = x->i.cs[i];
+        if (bst_reduce_node(b, y, func, last) == 0) {
+            free(y);
+            continue;
+        }
+        if (c > 0) {
+            x->i.as[c - 1] = x->i.as[i - 1];
+        }
+        x->i.cs[c++] = y;
+    }
+    x->n = (uint32_t) c;
+    return c;
+}
+
+size_t bst_reduce(bst *b, bool (*func)(void_ptr)) {
+    if (b->root == null) {
+        return 0;
+    }
+
+    bst_node *last = null;
+    b->n = 0;
+    b->head = null;
+    if (bst_reduce_node(b, b->root, func, &last) == 0) {
+        free(b->root);
+        b->root = null;
+    } else {
+        last->l.next = null;
+        bst_shrink(b);
+    }
+
+    return b->n;
+}
@@ -0,0 +1,42 @@
+#ifndef BST
+#define BST
+
+#include "defs.h"
+#include <stddef.h>
+
+typedef struct bst bst;
+
+// initialize the bst, an in-memory B+tree ordered by 'cmp' that keeps duplicates like bsa
+extern bst *bst_init(int (*cmp)(const void_ptr , const void_ptr));
+
+// build a bst from 'n' items already sorted by 'cmp' in O(n), return null on failure or unsorted input
+extern bst *bst_load(int (*cmp)(const void_ptr , const void_ptr), void_ptr const *as, size_t n);
+
+// free the memory used directly by the bst
+extern void bst_free(bst *b);
+
+// insert an item into the bst in O(log n)
+extern bool bst_push(bst *b, void_ptr a);
+
+// remove and return the least item out of the tree
+extern void_ptr bst_pop(bst *b);
+
+// return the least item in the tree
+extern void_ptr bst_peek(bst *b);
+
+// returns whether the tree has the item
+extern bool bst_has(bst *b, void_ptr a);
+
+// returns whether the tree is empty
+extern bool bst_empty(bst *b);
+
+// number of items in the tree
+extern size_t bst_size(bst *b);
+
+// applies the function to each of the elements in the bst in order
+extern void bst_foreach(bst *b, void_ptr (*func)(void_ptr));
+
+// remove the items marked as false by the function, returns the new size of the bst
+extern size_t bst_reduce(bst *b, bool (*func)(void_ptr));
+
+#endif
@@ -2,24 +2,126 @@
 #include <string.h>
 #include "heap.h"
 
+#define H_CACHE_LINE 64
+
+// the root sits at index d - 1 so the children of every node start on a multiple of d,
+// which for d = 2 is the usual 1-based layout
 struct heap {
     const int8_t t;
     size_t m;
     size_t n;
+    size_t d;
     void_ptr *as;
 
     bool (*cmp)(void const *, void const *);
 };
 
+// index of the root, the first child and the parent
+#define H_ROOT(h) ((h)->d - 1)
+#define H_CHILD(h, i) ((h)->d * ((i) - (h)->d + 2))
+#define H_PARENT(h, i) ((i) / (h)->d + (h)->d - 2)
+
+// allocate room for 'm' slots on a cache line boundary
+static void_ptr *h_alloc(size_t m) {
+    size_t bytes = (m * sizeof(void_ptr) + H_CACHE_LINE - 1) / H_CACHE_LINE * H_CACHE_LINE;
+    return aligned_alloc(H_CACHE_LINE, bytes);
+}
+
+// grow the array so 'k' more items fit
+static bool h_reserve(heap *h, size_t k) {
+    size_t need = H_ROOT(h) + h->n + k + 1;
+    if (need <= h->m) {
+        return true;
+    }
+
+    size_t new_size = h->m << 2;
+    while (new_size < need) {
+        new_size <<= 2;
+    }
+    void_ptr *new_fs;
+    if ((new_fs = h_alloc(new_size)) == null) {
+        return false;
+    }
+    memcpy(new_fs, h->as, h->m * sizeof(void_ptr));
+    free(h->as);
+    h->as = new_fs;
+    h->m = new_size;
+
+    return true;
+}
+
+// move the best child up into the hole at 'curr' until 'a' fits, 'last' is one past the last item
+static void h_sift_down(heap *h, size_t curr, void_ptr a, size_t last) {
+    while (true) {
+        size_t c = H_CHILD(h, curr);
+        if (c >= last) {
+            break;
+        }
+
+        size_t i, end = c + h->d < last ? c + h->d : last;
+        size_t best = c;
+        for (i = c + 1; i < end; i++) {
+            if (h->cmp(h->as[i], h->as[best])) {
+                best = i;
+            }
+        }
+        if (!h->cmp(h->as[best], a)) {
+            break;
+        }
+        h->as[curr] = h->as[best];
+        curr = best;
+    }
+    h->as[curr] = a;
+}
+
+// restore heap order bottom-up in O(n)
+static void h_heapify(heap *h) {
+    if (h->n < 2) {
+        return;
+    }
+
+    size_t last = H_ROOT(h) + h->n;
+    size_t i = H_PARENT(h, last - 1) + 1;
+    while (i-- > H_ROOT(h)) {
+        h_sift_down(h, i, h->as[i], last);
+    }
+}
+
 heap *h_init(size_t m, bool (*cmp)(void const *, void const *)) {
-    heap *h = malloc(sizeof(heap));
+    return h_init_d(m, 2, cmp);
+}
+
+heap *h_init_d(size_t m, size_t d, bool (*cmp)(void const *, void const *)) {
+    heap *h;
+    if (d < 2 || (h = malloc(sizeof(heap))) == null) {
+        return null;
+    }
 
     *((int8_t *) h) = 3;
-    h->m = m;
+    h->m = m < d + 1 ? d + 1 : m;
     h->n = 0;
+    h->d = d;
     h->cmp = cmp;
-    h->as = malloc(h->m * sizeof(void_ptr));
-    h->as[0] = null;
+    if ((h->as = h_alloc(h->m)) == null) {
+        free(h);
+        return null;
+    }
+    memset(h->as, 0, d * sizeof(void_ptr));
+
+    return h;
+}
+
+heap *h_from_array(void_ptr const *as, size_t n, size_t d, bool (*cmp)(void const *, void const *)) {
+    heap *h;
+    if ((as == null && n > 0) || (h = h_init_d(d + n, d, cmp)) == null) {
+        return null;
+    }
+
+    if (n > 0) {
+        memcpy(h->as + H_ROOT(h), as, n * sizeof(void_ptr));
+    }
+    h->n = n;
+    h_heapify(h);
 
     return h;
 }
@@ -30,12 +132,17 @@ heap *h_copy(heap *h, size_t m) {
         return null;
     }
 
-    new_h->m = m;
-    new_h->as = malloc(m * sizeof(void_ptr));
+    *((int8_t *) new_h) = 3;
+    new_h->d = h->d;
+    new_h->m = m < h->d + 1 ? h->d + 1 : m;
+    if ((new_h->as = h_alloc(new_h->m)) == null) {
+        free(new_h);
+        return null;
+    }
 
-    new_h->n = h->n > m ? m : h->n;
+    new_h->n = H_ROOT(h) + h->n >= new_h->m ? new_h->m - H_ROOT(h) - 1 : h->n;
     new_h->cmp = h->cmp;
-    memcpy(new_h->as, h->as, new_h->n * sizeof(void_ptr));
+    memcpy(new_h->as, h->as, (H_ROOT(h) + new_h->n) * sizeof(void_ptr));
 
     return new_h;
 }
@@ -46,70 +153,83 @@ void h_free(heap *h) {
 }
 
 bool h_push(heap *h, void_ptr a) {
+    if (!h_reserve(h, 1)) {
+        return false;
+    }
+    size_t curr = H_ROOT(h) + h->n;
     h->n++;
-    if (h->n == h->m) {
-        size_t new_size = h->m << 2;
-        void_ptr *new_fs;
-        if ((new_fs = malloc(new_size * sizeof(void_ptr))) == null) {
-            return false;
+
+    // move parents down into the hole until 'a' fits
+    while (curr > H_ROOT(h)) {
+        size_t up = H_PARENT(h, curr);
+        if (!h->cmp(a, h->as[up])) {
+            break;
         }
-        memmove(new_fs, h->as, h->m * sizeof(void_ptr));
-        free(h->as);
-        h->as = new_fs;
-        h->m = new_size;
+        h->as[curr] = h->as[up];
+        curr = up;
+    }
+    h->as[curr] = a;
+
+    return true;
+}
+
+bool h_push_many(heap *h, void_ptr const *as, size_t k) {
+    if (k == 0) {
+        return true;
+    }
+    if (as == null || !h_reserve(h, k)) {
+        return false;
+    }
+
+    // k pushes cost about k * log_d(n + k) comparisons against about 2 * (n + k) for a rebuild
+    size_t i, total = h->n + k, depth = 1;
+    for (i = total; i >= h->d; i /= h->d) {
+        depth++;
+    }
+    if (k * depth > 2 * total) {
+        memcpy(h->as + H_ROOT(h) + h->n, as, k * sizeof(void_ptr));
+        h->n = total;
+        h_heapify(h);
+        return true;
     }
 
-    h->as[h->n] = a;
+    for (i = 0; i < k; i++) {
+        h_push(h, as[i]);
+    }
 
-    size_t curr = h->n;
-    size_t half = h->n >> 1;
-    while (half > 0 && h->cmp(h->as[curr], h->as[half])) {
-        void_ptr tmp = h->as[half];
-        h->as[half] = h->as[curr];
-        h->as[curr] = tmp;
+    return true;
+}
 
-        curr = half;
-        half = half >> 1;
+bool h_concat(heap *dest, heap *src) {
+    if (dest == null || src == null || dest == src || !h_push_many(dest, src->as + H_ROOT(src), src->n)) {
+        return false;
     }
 
+    h_free(src);
     return true;
 }
 
 void_ptr h_peek(heap *h) {
-    return h->n == 0 ? null : h->as[1];
+    return h->n == 0 ? null : h->as[H_ROOT(h)];
 }
 
 void_ptr h_pop(heap *h) {
-    if (h->n <= 1) {
-        size_t i = h->n;
-        h->n = 0;
-        return h->as[i];
+    if (h->n == 0) {
+        return null;
     }
 
-    void_ptr f = h->as[1];
-    h->as[1] = h->as[h->n];
-    h->as[h->n] = null;
-
-    size_t curr = 1;
-    while (true) {
-        size_t l = curr << 1;
-        size_t r = l + 1;
-        if (r < h->n && h->cmp(h->as[r], h->as[l]) && h->cmp(h->as[r], h->as[curr])) {
-            void_ptr t = h->as[curr];
-            h->as[curr] = h->as[r];
-            h->as[r] = t;
-            curr = r;
-        } else if (l < h->n && h->cmp(h->as[l], h->as[curr])) {
-            void_ptr t = h->as[curr];
-            h->as[curr] = h->as[l];
-            h->as[l] = t;
-            curr = l;
-        } else {
-            break;
-        }
+    size_t curr = H_ROOT(h);
+    size_t last = curr + --h->n;
+    void_ptr f = h->as[curr];
+    void_ptr a = h->as[last];
+    h->as[last] = null;
+    if (h->n == 0) {
+        return f;
     }
 
-    h->n--;
+    // move the best child up into the hole until the old last item fits
+    h_sift_down(h, curr, a, last);
+
     return f;
 }
 
@@ -117,26 +237,30 @@ bool h_empty(heap *h) {
     return h->n == 0;
 }
 
+size_t h_size(heap *h) {
+    return h->n;
+}
+
 void h_foreach(heap *h, void_ptr (*func)(void_ptr)) {
     size_t i;
-    for (i = 1; i < h->n; i++) {
+    for (i = H_ROOT(h); i < H_ROOT(h) + h->n; i++) {
         h->as[i] = (func)(h->as[i]);
     }
 }
 
 size_t h_reduce(heap *h, bool (*func)(void_ptr)) {
-    size_t i, c = 1;
-    for (i = 1; i <= h->n && (func)(h->as[i]); i++, c++) {
-    }
-
-    if (c <= h->n) {
-        for (i++; i < h->n; i++) {
-            if ((func)(h->as[i])) {
-                h->as[c++] = h->as[i];
-            }
+    size_t i, c = H_ROOT(h), last = H_ROOT(h) + h->n;
+    for (i = c; i < last; i++) {
+        if ((func)(h->as[i])) {
+            h->as[c++] = h->as[i];
         }
+    }
 
-        h->n = c;
+    // compaction only breaks the order when something was removed
+    if (c < last) {
+        memset(h->as + c, 0, (last - c) * sizeof(void_ptr));
+        h->n = c - H_ROOT(h);
+        h_heapify(h);
     }
 
     return h->n;
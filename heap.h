@@ -8,12 +8,26 @@ typedef struct heap heap;
 // initialize the heap with the given comparison function
 extern heap *h_init(size_t m, bool (*cmp)(void const *, void const *));
 
+// initialize a 'd'-ary heap, the array is cache-line aligned so the children of a node share a line
+// 4 or 8 make pops touch fewer lines than the binary heap of h_init; return null if 'd' is below 2
+extern heap *h_init_d(size_t m, size_t d, bool (*cmp)(void const *, void const *));
+
+// build a 'd'-ary heap of the 'n' items in 'as' in O(n), 'd' as for h_init_d; return null on failure
+extern heap *h_from_array(void_ptr const *as, size_t n, size_t d, bool (*cmp)(void const *, void const *));
+
 // copy the old heap into a new heap of size 's', init a new heap if 'h' is null
 extern heap *h_copy(heap *h, size_t m);
 
 // insert a fraction into the heap, return true if successful
 extern bool h_push(heap *h, void_ptr a);
 
+// insert 'k' items at once, rebuilding the heap when that is cheaper than 'k' pushes; return true if successful
+extern bool h_push_many(heap *h, void_ptr const *as, size_t k);
+
+// move the items of the src heap into the dest heap and free src, both must share the comparison function
+// this costs O(n) at best, pheap melds in O(1) where heaps get merged often
+extern bool h_concat(heap *dest, heap *src);
+
 // peek the top of the heap
 extern void_ptr h_peek(heap *h);
 
@@ -26,6 +40,9 @@ extern void h_free(heap *h);
 // returns whether the tree is empty
 extern bool h_empty(heap *h);
 
+// number of items in the heap
+extern size_t h_size(heap *h);
+
 // applies the function to each of the elements in the heap
 extern void h_foreach(heap *h, void_ptr (*func)(void_ptr));
 
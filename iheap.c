@@ -0,0 +1,210 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include "iheap.h"
+
+// binary heap of handles, each handle knows its item and its slot in the heap
+struct iheap {
+    const int8_t t;
+    // slots in the heap array and items in it
+    size_t m;
+    size_t n;
+    size_t *hs;
+    // item and heap slot of every handle ever handed out, 'pos' is IH_NONE for free handles
+    // whose 'as' entry links to the next free handle instead
+    void_ptr *as;
+    size_t *pos;
+    size_t num;
+    size_t free;
+
+    bool (*cmp)(void const *, void const *);
+};
+
+// move the handle at slot 'i' up or down until it fits, keeping 'pos' in step
+static void ih_sift_up(iheap *h, size_t i);
+static void ih_sift_down(iheap *h, size_t i);
+
+// grow the arrays so one more item fits
+static bool ih_grow(iheap *h);
+
+iheap *ih_init(size_t m, bool (*cmp)(void const *, void const *)) {
+    iheap *h;
+    if ((h = malloc(sizeof(iheap))) == null) {
+        return null;
+    }
+
+    *((int8_t *) h) = 8;
+    h->m = m == 0 ? 1 : m;
+    h->n = 0;
+    h->num = 0;
+    h->free = IH_NONE;
+    h->cmp = cmp;
+    h->hs = malloc(h->m * sizeof(size_t));
+    h->as = malloc(h->m * sizeof(void_ptr));
+    h->pos = malloc(h->m * sizeof(size_t));
+    if (h->hs == null || h->as == null || h->pos == null) {
+        ih_free(h);
+        return null;
+    }
+
+    return h;
+}
+
+void ih_free(iheap *h) {
+    free(h->hs);
+    free(h->as);
+    free(h->pos);
+    free(h);
+}
+
+size_t ih_push(iheap *h, void_ptr a) {
+    // reuse a free handle before minting a new one
+    size_t hd = h->free;
+    if (hd != IH_NONE) {
+        h->free = (size_t) (uintptr_t) h->as[hd];
+    } else {
+        if (h->num == h->m && !ih_grow(h)) {
+            return IH_NONE;
+        }
+        hd = h->num++;
+    }
+
+    h->as[hd] = a;
+    h->hs[h->n] = hd;
+    h->pos[hd] = h->n;
+    ih_sift_up(h, h->n++);
+
+    return hd;
+}
+
+void_ptr ih_peek(iheap *h) {
+    return h->n == 0 ? null : h->as[h->hs[0]];
+}
+
+void_ptr ih_pop(iheap *h) {
+    return h->n == 0 ? null : ih_remove(h, h->hs[0]);
+}
+
+size_t ih_top(iheap *h) {
+    return h->n == 0 ? IH_NONE : h->hs[0];
+}
+
+bool ih_empty(iheap *h) {
+    return h->n == 0;
+}
+
+size_t ih_size(iheap *h) {
+    return h->n;
+}
+
+bool ih_has(iheap *h, size_t hd) {
+    return hd < h->num && h->pos[hd] != IH_NONE;
+}
+
+void_ptr ih_get(iheap *h, size_t hd) {
+    return ih_has(h, hd) ? h->as[hd] : null;
+}
+
+bool ih_update(iheap *h, size_t hd) {
+    if (!ih_has(h, hd)) {
+        return false;
+    }
+
+    // only one of the two moves the item
+    size_t i = h->pos[hd];
+    ih_sift_up(h, i);
+    if (h->pos[hd] == i) {
+        ih_sift_down(h, i);
+    }
+
+    return true;
+}
+
+bool ih_set(iheap *h, size_t hd, void_ptr a) {
+    if (!ih_has(h, hd)) {
+        return false;
+    }
+
+    h->as[hd] = a;
+    return ih_update(h, hd);
+}
+
+void_ptr ih_remove(iheap *h, size_t hd) {
+    if (!ih_has(h, hd)) {
+        return null;
+    }
+
+    // fill the hole with the last item and let it settle
+    size_t i = h->pos[hd];
+    void_ptr a = h->as[hd];
+    size_t last = h->hs[--h->n];
+    if (last != hd) {
+        h->hs[i] = last;
+        h->pos[last] = i;
+        ih_update(h, last);
+    }
+
+    h->pos[hd] = IH_NONE;
+    h->as[hd] = (void_ptr) (uintptr_t) h->free;
+    h->free = hd;
+
+    return a;
+}
+
+static void ih_sift_up(iheap *h, size_t i) {
+    size_t hd = h->hs[i];
+    while (i > 0) {
+        size_t up = (i - 1) >> 1;
+        if (!h->cmp(h->as[hd], h->as[h->hs[up]])) {
+            break;
+        }
+        h->hs[i] = h->hs[up];
+        h->pos[h->hs[i]] = i;
+        i = up;
+    }
+    h->hs[i] = hd;
+    h->pos[hd] = i;
+}
+
+static void ih_sift_down(iheap *h, size_t i) {
+    size_t hd = h->hs[i];
+    while (true) {
+        size_t c = (i << 1) + 1;
+        if (c >= h->n) {
+            break;
+        }
+        if (c + 1 < h->n && h->cmp(h->as[h->hs[c + 1]], h->as[h->hs[c]])) {
+            c++;
+        }
+        if (!h->cmp(h->as[h->hs[c]], h->as[hd])) {
+            break;
+        }
+        h->hs[i] = h->hs[c];
+        h->pos[h->hs[i]] = i;
+        i = c;
+    }
+    h->hs[i] = hd;
+    h->pos[hd] = i;
+}
+
+static bool ih_grow(iheap *h) {
+    size_t m = h->m << 1;
+    size_t *hs, *pos;
+    void_ptr *as;
+
+    // m only grows once all three arrays have, a failure leaves the heap usable
+    if ((hs = realloc(h->hs, m * sizeof(size_t))) == null) {
+        return false;
+    }
+    h->hs = hs;
+    if ((as = realloc(h->as, m * sizeof(void_ptr))) == null) {
+        return false;
+    }
+    h->as = as;
+    if ((pos = realloc(h->pos, m * sizeof(size_t))) == null) {
+        return false;
+    }
+    h->pos = pos;
+    h->m = m;
+
+    return true;
+}
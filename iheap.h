@@ -0,0 +1,53 @@
+#ifndef IHEAP
+#define IHEAP
+
+#include <stddef.h>
+#include "defs.h"
+
+// returned by ih_push on failure
+#define IH_NONE ((size_t) -1)
+
+// heap whose items can be found again through the handle ih_push returns
+typedef struct iheap iheap;
+
+// initialize the indexed heap with room for 'm' items and the given comparison function
+extern iheap *ih_init(size_t m, bool (*cmp)(void const *, void const *));
+
+// free the memory used directly by the indexed heap
+extern void ih_free(iheap *h);
+
+// insert an item and return its handle, IH_NONE on failure
+// a handle stays valid until its item is popped or removed, after which it may be reused
+extern size_t ih_push(iheap *h, void_ptr a);
+
+// peek the top of the heap
+extern void_ptr ih_peek(iheap *h);
+
+// pop the top of the heap and remove it from the heap
+extern void_ptr ih_pop(iheap *h);
+
+// handle of the top of the heap, IH_NONE when empty
+extern size_t ih_top(iheap *h);
+
+// returns whether the heap is empty
+extern bool ih_empty(iheap *h);
+
+// number of items in the heap
+extern size_t ih_size(iheap *h);
+
+// returns whether the handle names an item in the heap
+extern bool ih_has(iheap *h, size_t hd);
+
+// the item behind the handle, null if there is none
+extern void_ptr ih_get(iheap *h, size_t hd);
+
+// restore the order after the priority of the item behind the handle changed in either direction, O(log n)
+extern bool ih_update(iheap *h, size_t hd);
+
+// replace the item behind the handle and restore the order, O(log n)
+extern bool ih_set(iheap *h, size_t hd, void_ptr a);
+
+// remove the item behind the handle and return it, null if there is none, O(log n)
+extern void_ptr ih_remove(iheap *h, size_t hd);
+
+#endif // IHEAP
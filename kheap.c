@@ -0,0 +1,137 @@
+#include <stdlib.h>
+#include <string.h>
+#include "kheap.h"
+
+#define KH_CACHE_LINE 64
+#define KH_D 4
+
+// the root sits at index KH_D - 1 so the KH_D children of a node fill one aligned cache line
+#define KH_ROOT (KH_D - 1)
+#define KH_CHILD(i) (KH_D * ((i) - KH_D + 2))
+#define KH_PARENT(i) ((i) / KH_D + KH_D - 2)
+
+typedef struct {
+    uint64_t key;
+    void_ptr a;
+} kh_entry;
+
+struct kheap {
+    const int8_t t;
+    size_t m;
+    size_t n;
+    kh_entry *es;
+};
+
+// allocate room for 'm' entries on a cache line boundary
+static kh_entry *kh_alloc(size_t m) {
+    size_t bytes = (m * sizeof(kh_entry) + KH_CACHE_LINE - 1) / KH_CACHE_LINE * KH_CACHE_LINE;
+    return aligned_alloc(KH_CACHE_LINE, bytes);
+}
+
+kheap *kh_init(size_t m) {
+    kheap *h;
+    if ((h = malloc(sizeof(kheap))) == null) {
+        return null;
+    }
+
+    *((int8_t *) h) = 9;
+    h->m = m < KH_D + 1 ? KH_D + 1 : m;
+    h->n = 0;
+    if ((h->es = kh_alloc(h->m)) == null) {
+        free(h);
+        return null;
+    }
+
+    return h;
+}
+
+void kh_free(kheap *h) {
+    free(h->es);
+    free(h);
+}
+
+bool kh_push(kheap *h, uint64_t key, void_ptr a) {
+    size_t curr = KH_ROOT + h->n;
+    if (curr + 1 >= h->m) {
+        size_t new_size = h->m << 2;
+        kh_entry *new_es;
+        if ((new_es = kh_alloc(new_size)) == null) {
+            return false;
+        }
+        memcpy(new_es, h->es, h->m * sizeof(kh_entry));
+        free(h->es);
+        h->es = new_es;
+        h->m = new_size;
+    }
+    h->n++;
+
+    // move parents down into the hole until the key fits
+    while (curr > KH_ROOT) {
+        size_t up = KH_PARENT(curr);
+        if (h->es[up].key <= key) {
+            break;
+        }
+        h->es[curr] = h->es[up];
+        curr = up;
+    }
+    h->es[curr].key = key;
+    h->es[curr].a = a;
+
+    return true;
+}
+
+void_ptr kh_peek(kheap *h) {
+    return h->n == 0 ? null : h->es[KH_ROOT].a;
+}
+
+uint64_t kh_peek_key(kheap *h) {
+    return h->es[KH_ROOT].key;
+}
+
+void_ptr kh_pop(kheap *h) {
+    if (h->n == 0) {
+        return null;
+    }
+
+    size_t curr = KH_ROOT;
+    size_t last = KH_ROOT + --h->n;
+    void_ptr f = h->es[curr].a;
+    kh_entry e = h->es[last];
+
+    // move the smallest child up into the hole until the old last entry fits
+    while (true) {
+        size_t c = KH_CHILD(curr), best;
+        if (c + KH_D <= last) {
+            // a full line of children, pick the smallest with selects rather than branches
+            kh_entry const *cs = h->es + c;
+            size_t l = cs[1].key < cs[0].key;
+            size_t r = 2 + (cs[3].key < cs[2].key);
+            best = c + (cs[r].key < cs[l].key ? r : l);
+        } else if (c < last) {
+            size_t i;
+            best = c;
+            for (i = c + 1; i < last; i++) {
+                best = h->es[i].key < h->es[best].key ? i : best;
+            }
+        } else {
+            break;
+        }
+
+        if (h->es[best].key >= e.key) {
+            break;
+        }
+        h->es[curr] = h->es[best];
+        curr = best;
+    }
+    h->es[curr] = e;
+
+    return f;
+}
+
+bool kh_empty(kheap *h) {
+    return h->n == 0;
+}
+
+size_t kh_size(kheap *h) {
+    return h->n;
+}
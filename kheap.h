@@ -0,0 +1,43 @@
+#ifndef KHEAP
+#define KHEAP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "defs.h"
+
+// min-heap of payloads ordered by a 64-bit key stored next to them, so sifting never calls out or dereferences
+typedef struct kheap kheap;
+
+// initialize the key heap with room for 'm' items
+extern kheap *kh_init(size_t m);
+
+// free the memory used directly by the key heap
+extern void kh_free(kheap *h);
+
+// insert a payload with the given key, return true if successful
+extern bool kh_push(kheap *h, uint64_t key, void_ptr a);
+
+// peek the payload with the smallest key
+extern void_ptr kh_peek(kheap *h);
+
+// the smallest key, only meaningful when the heap isn't empty
+extern uint64_t kh_peek_key(kheap *h);
+
+// pop the payload with the smallest key and remove it from the heap
+extern void_ptr kh_pop(kheap *h);
+
+// returns whether the heap is empty
+extern bool kh_empty(kheap *h);
+
+// number of items in the heap
+extern size_t kh_size(kheap *h);
+
+// key that orders doubles the same way as the keys compare, NaNs sort last
+static inline uint64_t kh_dkey(double d) {
+    uint64_t u;
+    memcpy(&u, &d, sizeof(u));
+    return (u >> 63) ? ~u : u | ((uint64_t) 1 << 63);
+}
+
+#endif // KHEAP
@@ -1,4 +1,5 @@
 #ifndef OPTIONAL
+#define OPTIONAL
 #include "defs.h"
 
 typedef struct {
@@ -0,0 +1,272 @@
+#include <stdlib.h>
+#include "pheap.h"
+
+// nodes are kept as a binary tree, 'child' is the first child and 'next' the following sibling
+typedef struct ph_node ph_node;
+struct ph_node {
+    void_ptr a;
+    ph_node *child;
+    ph_node *next;
+};
+
+// block of nodes, blocks are only freed with the heap
+typedef struct ph_pool ph_pool;
+struct ph_pool {
+    ph_pool *next;
+    ph_node ns[];
+};
+
+struct pheap {
+    const int8_t t;
+    size_t n;
+    ph_node *root;
+    // free nodes linked through 'next', the tail makes handing them to another heap O(1)
+    ph_node *free;
+    ph_node *free_tail;
+    // node blocks, the size of the next one doubles up to PH_POOL_MAX
+    ph_pool *pools;
+    ph_pool *pools_tail;
+    size_t grow;
+
+    bool (*cmp)(void const *, void const *);
+};
+
+#define PH_POOL_MAX 4096
+
+// take a node from the free list, allocating a new block when it is empty
+static ph_node *ph_node_get(pheap *h);
+
+// return a node to the free list
+static void ph_node_put(pheap *h, ph_node *x);
+
+// make the lesser of two roots the first child of the other and return the new root
+static ph_node *ph_link(pheap *h, ph_node *x, ph_node *y);
+
+// merge a sibling list into one tree, pairing left to right then folding right to left
+static ph_node *ph_combine(pheap *h, ph_node *list);
+
+// unlink every node of the tree into one sibling list
+static ph_node *ph_flatten(ph_node *root);
+
+pheap *ph_init(size_t m, bool (*cmp)(void const *, void const *)) {
+    pheap *h;
+    if ((h = malloc(sizeof(pheap))) == null) {
+        return null;
+    }
+
+    *((int8_t *) h) = 10;
+    h->n = 0;
+    h->root = null;
+    h->free = h->free_tail = null;
+    h->pools = h->pools_tail = null;
+    h->grow = m == 0 ? 1 : m;
+    h->cmp = cmp;
+
+    return h;
+}
+
+void ph_free(pheap *h) {
+    ph_pool *p, *next;
+    for (p = h->pools; p != null; p = next) {
+        next = p->next;
+        free(p);
+    }
+    free(h);
+}
+
+bool ph_push(pheap *h, void_ptr a) {
+    ph_node *x;
+    if ((x = ph_node_get(h)) == null) {
+        return false;
+    }
+
+    x->a = a;
+    x->child = x->next = null;
+    h->root = h->root == null ? x : ph_link(h, h->root, x);
+    h->n++;
+
+    return true;
+}
+
+void_ptr ph_peek(pheap *h) {
+    return h->root == null ? null : h->root->a;
+}
+
+void_ptr ph_pop(pheap *h) {
+    ph_node *x = h->root;
+    if (x == null) {
+        return null;
+    }
+
+    void_ptr a = x->a;
+    h->root = ph_combine(h, x->child);
+    h->n--;
+    ph_node_put(h, x);
+
+    return a;
+}
+
+bool ph_empty(pheap *h) {
+    return h->n == 0;
+}
+
+size_t ph_size(pheap *h) {
+    return h->n;
+}
+
+bool ph_concat(pheap *dest, pheap *src) {
+    if (dest == null || src == null || dest == src) {
+        return false;
+    }
+
+    if (src->root != null) {
+        dest->root = dest->root == null ? src->root : ph_link(dest, dest->root, src->root);
+        dest->n += src->n;
+    }
+
+    // the nodes now in dest live in src's blocks, so the blocks and free nodes move over too
+    if (src->pools != null) {
+        if (dest->pools == null) {
+            dest->pools = src->pools;
+        } else {
+            dest->pools_tail->next = src->pools;
+        }
+        dest->pools_tail = src->pools_tail;
+    }
+    if (src->free != null) {
+        if (dest->free == null) {
+            dest->free = src->free;
+        } else {
+            dest->free_tail->next = src->free;
+        }
+        dest->free_tail = src->free_tail;
+    }
+
+    free(src);
+    return true;
+}
+
+void ph_foreach(pheap *h, void_ptr (*func)(void_ptr)) {
+    ph_node *x, *list = ph_flatten(h->root);
+    for (x = list; x != null; x = x->next) {
+        x->a = (func)(x->a);
+    }
+    h->root = ph_combine(h, list);
+}
+
+size_t ph_reduce(pheap *h, bool (*func)(void_ptr)) {
+    ph_node *x, *next, *keep = null, *list = ph_flatten(h->root);
+    for (x = list; x != null; x = next) {
+        next = x->next;
+        if ((func)(x->a)) {
+            x->next = keep;
+            keep = x;
+        } else {
+            ph_node_put(h, x);
+            h->n--;
+        }
+    }
+    h->root = ph_combine(h, keep);
+
+    return h->n;
+}
+
+static ph_node *ph_node_get(pheap *h) {
+    if (h->free == null) {
+        ph_pool *p;
+        if ((p = malloc(sizeof(ph_pool) + h->grow * sizeof(ph_node))) == null) {
+            return null;
+        }
+        p->next = null;
+        if (h->pools == null) {
+            h->pools = p;
+        } else {
+            h->pools_tail->next = p;
+        }
+        h->pools_tail = p;
+
+        size_t i;
+        for (i = 0; i + 1 < h->grow; i++) {
+            p->ns[i].next = &p->ns[i + 1];
+        }
+        p->ns[h->grow - 1].next = null;
+        h->free = &p->ns[0];
+        h->free_tail = &p->ns[h->grow - 1];
+        if (h->grow < PH_POOL_MAX) {
+            h->grow <<= 1;
+        }
+    }
+
+    ph_node *x = h->free;
+    if ((h->free = x->next) == null) {
+        h->free_tail = null;
+    }
+    return x;
+}
+
+static void ph_node_put(pheap *h, ph_node *x) {
+    if (h->free == null) {
+        h->free_tail = x;
+    }
+    x->next = h->free;
+    h->free = x;
+}
+
+static ph_node *ph_link(pheap *h, ph_node *x, ph_node *y) {
+    // ties keep the older root on top
+    if (h->cmp(y->a, x->a)) {
+        ph_node *t = x;
+        x = y;
+        y = t;
+    }
+    y->next = x->child;
+    x->child = y;
+    x->next = null;
+    return x;
+}
+
+static ph_node *ph_combine(pheap *h, ph_node *list) {
+    // link neighbours in pairs, stacking the results in reverse
+    ph_node *pairs = null;
+    while (list != null) {
+        ph_node *x = list, *y = list->next;
+        if (y == null) {
+            x->next = pairs;
+            pairs = x;
+            break;
+        }
+        list = y->next;
+        x = ph_link(h, x, y);
+        x->next = pairs;
+        pairs = x;
+    }
+
+    // fold the pairs back from the last one
+    ph_node *root = null;
+    while (pairs != null) {
+        ph_node *next = pairs->next;
+        pairs->next = null;
+        root = root == null ? pairs : ph_link(h, pairs, root);
+        pairs = next;
+    }
+
+    return root;
+}
+
+static ph_node *ph_flatten(ph_node *root) {
+    // splice each node's children in right behind it, every child list is walked once
+    ph_node *x;
+    for (x = root; x != null; x = x->next) {
+        if (x->child != null) {
+            ph_node *tail = x->child;
+            while (tail->next != null) {
+                tail = tail->next;
+            }
+            tail->next = x->next;
+            x->next = x->child;
+            x->child = null;
+        }
+    }
+
+    return root;
+}
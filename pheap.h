@@ -0,0 +1,40 @@
+#ifndef PHEAP
+#define PHEAP
+
+#include <stddef.h>
+#include "defs.h"
+
+// pairing heap over pooled nodes, pushes and melds are O(1) and pops O(log n) amortized
+typedef struct pheap pheap;
+
+// initialize the pairing heap with node pools of at least 'm' items and the given comparison function
+extern pheap *ph_init(size_t m, bool (*cmp)(void const *, void const *));
+
+// free the memory used directly by the pairing heap
+extern void ph_free(pheap *h);
+
+// insert an item into the heap, return true if successful
+extern bool ph_push(pheap *h, void_ptr a);
+
+// peek the top of the heap
+extern void_ptr ph_peek(pheap *h);
+
+// pop the top of the heap and remove it from the heap
+extern void_ptr ph_pop(pheap *h);
+
+// returns whether the heap is empty
+extern bool ph_empty(pheap *h);
+
+// number of items in the heap
+extern size_t ph_size(pheap *h);
+
+// meld the src heap into the dest heap in O(1), src is freed and must share the comparison function
+extern bool ph_concat(pheap *dest, pheap *src);
+
+// applies the function to each of the elements in the heap, the order is rebuilt afterwards
+extern void ph_foreach(pheap *h, void_ptr (*func)(void_ptr));
+
+// remove the items marked as false by the function, returns the new size of the heap
+extern size_t ph_reduce(pheap *h, bool (*func)(void_ptr));
+
+#endif // PHEAP
@@ -0,0 +1,369 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "reactor.h"
+
+// events read from epoll per wakeup, dispatched as one batch
+#define RT_BATCH 64
+
+typedef struct rt_watch rt_watch;
+struct rt_watch {
+    reactor *r;
+    int fd;
+    void *(*func)(int, int, void *);
+    void *arg;
+    int pty;
+    // events seen since the callback last ran
+    atomic_int ready;
+    // a dispatch is queued or running, so events only need to be recorded
+    atomic_bool queued;
+    // cleared by rt_del, queued dispatches then skip the callback
+    atomic_bool live;
+    // the registration plus one per queued dispatch
+    atomic_size_t refs;
+    // link in the list of watches removed by rt_del
+    rt_watch *next;
+};
+
+struct reactor {
+    threadpool *pool;
+    pthread_t t;
+    int efd;
+    // eventfd that wakes the reactor thread for shutdown
+    int wake;
+    // watches indexed by fd
+    pthread_mutex_t lock;
+    rt_watch **ws;
+    size_t num_ws;
+    // removed watches, released by the reactor thread once no event it holds can name them
+    rt_watch *dead;
+    // dispatches queued or running plus one held until rt_dest, whoever drops the last sets 'drained'
+    atomic_size_t inflight;
+    pthread_cond_t notify;
+    bool drained;
+    atomic_int shutdown;
+};
+
+// reactor thread, turns readiness into batches of dispatches
+static void *rt_thread(void *arg);
+
+// run a watch's callback until no new events are left
+static void *rt_dispatch(void *arg);
+
+// drop a reference to the watch, freeing it with the last one
+static void rt_release(rt_watch *w);
+
+// a dispatch has finished, wake rt_dest if it was the last
+static void rt_done(reactor *r);
+
+reactor *rt_init(threadpool *pool) {
+    reactor *r;
+    if (pool == null || (r = malloc(sizeof(reactor))) == null) {
+        return null;
+    }
+
+    r->pool = pool;
+    r->ws = null;
+    r->num_ws = 0;
+    r->dead = null;
+    r->inflight = 1;
+    r->drained = false;
+    r->shutdown = 0;
+    r->efd = r->wake = -1;
+
+    if (pthread_mutex_init(&r->lock, null) != 0) {
+        free(r);
+        return null;
+    }
+    if (pthread_cond_init(&r->notify, null) != 0) {
+        pthread_mutex_destroy(&r->lock);
+        free(r);
+        return null;
+    }
+
+    // the wakeup fd is level-triggered and carries no watch
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = null;
+    if ((r->efd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+            (r->wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0 ||
+            epoll_ctl(r->efd, EPOLL_CTL_ADD, r->wake, &ev) != 0 ||
+            pthread_create(&r->t, null, rt_thread, (void *) r) != 0) {
+        goto err;
+    }
+
+    return r;
+
+    err:
+    if (r->efd >= 0) {
+        close(r->efd);
+    }
+    if (r->wake >= 0) {
+        close(r->wake);
+    }
+    pthread_cond_destroy(&r->notify);
+    pthread_mutex_destroy(&r->lock);
+    free(r);
+    return null;
+}
+
+int rt_add(reactor *r, int fd, int events, void *(*func)(int, int, void *), void *arg, int priority) {
+    if (r == null || fd < 0 || func == null || (events & (rtev_read | rtev_write)) == 0) {
+        return rt_invalid;
+    }
+
+    rt_watch *w;
+    if ((w = malloc(sizeof(rt_watch))) == null) {
+        return rt_lockfail;
+    }
+    w->r = r;
+    w->fd = fd;
+    w->func = func;
+    w->arg = arg;
+    w->pty = priority;
+    atomic_init(&w->ready, 0);
+    atomic_init(&w->queued, false);
+    atomic_init(&w->live, true);
+    atomic_init(&w->refs, 1);
+
+    if (pthread_mutex_lock(&r->lock) != 0) {
+        free(w);
+        return rt_lockfail;
+    }
+    if (r->shutdown) {
+        pthread_mutex_unlock(&r->lock);
+        free(w);
+        return rt_shutdown;
+    }
+
+    // grow the table to cover the fd
+    if ((size_t) fd >= r->num_ws) {
+        size_t i, m = r->num_ws == 0 ? 64 : r->num_ws;
+        while (m <= (size_t) fd) {
+            m *= 2;
+        }
+        rt_watch **ws;
+        if ((ws = realloc(r->ws, m * sizeof(rt_watch *))) == null) {
+            pthread_mutex_unlock(&r->lock);
+            free(w);
+            return rt_lockfail;
+        }
+        for (i = r->num_ws; i < m; i++) {
+            ws[i] = null;
+        }
+        r->ws = ws;
+        r->num_ws = m;
+    }
+    if (r->ws[fd] != null) {
+        pthread_mutex_unlock(&r->lock);
+        free(w);
+        return rt_invalid;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLET | EPOLLRDHUP;
+    ev.events |= (events & rtev_read) ? EPOLLIN : 0;
+    ev.events |= (events & rtev_write) ? EPOLLOUT : 0;
+    ev.data.ptr = w;
+    if (epoll_ctl(r->efd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        pthread_mutex_unlock(&r->lock);
+        free(w);
+        return rt_sysfail;
+    }
+    r->ws[fd] = w;
+    pthread_mutex_unlock(&r->lock);
+
+    return 0;
+}
+
+int rt_del(reactor *r, int fd) {
+    if (r == null || fd < 0) {
+        return rt_invalid;
+    }
+
+    if (pthread_mutex_lock(&r->lock) != 0) {
+        return rt_lockfail;
+    }
+    rt_watch *w;
+    if ((size_t) fd >= r->num_ws || (w = r->ws[fd]) == null) {
+        pthread_mutex_unlock(&r->lock);
+        return rt_invalid;
+    }
+    r->ws[fd] = null;
+    epoll_ctl(r->efd, EPOLL_CTL_DEL, fd, null);
+
+    // events epoll has already returned may still name the watch, so the reactor thread releases it
+    atomic_store(&w->live, false);
+    w->next = r->dead;
+    r->dead = w;
+    pthread_mutex_unlock(&r->lock);
+
+    return 0;
+}
+
+int rt_dest(reactor *r, int flags) {
+    if (r == null) {
+        return rt_invalid;
+    }
+
+    if (pthread_mutex_lock(&r->lock) != 0) {
+        return rt_lockfail;
+    }
+    if (r->shutdown) {
+        pthread_mutex_unlock(&r->lock);
+        return rt_shutdown;
+    }
+    r->shutdown = (flags & tpsdown_soft) ? tpsdown_soft : tpsdown_now;
+    pthread_mutex_unlock(&r->lock);
+
+    // stop polling, nothing new gets queued after the thread is gone
+    uint64_t one = 1;
+    if (write(r->wake, &one, sizeof(one)) != sizeof(one) || pthread_join(r->t, null) != 0) {
+        return rt_threadfail;
+    }
+
+    // queued dispatches either run or skip their callback depending on the flag, wait for all of them
+    if (atomic_fetch_sub(&r->inflight, 1) != 1) {
+        pthread_mutex_lock(&r->lock);
+        while (!r->drained) {
+            pthread_cond_wait(&r->notify, &r->lock);
+        }
+        pthread_mutex_unlock(&r->lock);
+    }
+
+    size_t i;
+    for (i = 0; i < r->num_ws; i++) {
+        if (r->ws[i] != null) {
+            epoll_ctl(r->efd, EPOLL_CTL_DEL, (int) i, null);
+            rt_release(r->ws[i]);
+        }
+    }
+    rt_watch *w, *next;
+    for (w = r->dead; w != null; w = next) {
+        next = w->next;
+        rt_release(w);
+    }
+    free(r->ws);
+    close(r->efd);
+    close(r->wake);
+    pthread_cond_destroy(&r->notify);
+    pthread_mutex_destroy(&r->lock);
+    free(r);
+
+    return 0;
+}
+
+static void *rt_thread(void *arg) {
+    reactor *r = (reactor *) arg;
+    struct epoll_event evs[RT_BATCH];
+    tp_job jobs[RT_BATCH] = {{0}};
+
+    while (!r->shutdown) {
+        int i, k = epoll_wait(r->efd, evs, RT_BATCH, -1);
+        if (k < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        // record the events on each watch, queueing a dispatch only for watches without one
+        // the lock keeps rt_del from releasing a watch this batch names
+        size_t n = 0;
+        pthread_mutex_lock(&r->lock);
+        for (i = 0; i < k; i++) {
+            rt_watch *w = (rt_watch *) evs[i].data.ptr;
+            if (w == null) {
+                continue;
+            }
+
+            int ev = 0;
+            ev |= (evs[i].events & EPOLLIN) ? rtev_read : 0;
+            ev |= (evs[i].events & EPOLLOUT) ? rtev_write : 0;
+            ev |= (evs[i].events & (EPOLLHUP | EPOLLRDHUP)) ? rtev_hup : 0;
+            ev |= (evs[i].events & EPOLLERR) ? rtev_err : 0;
+            atomic_fetch_or(&w->ready, ev);
+
+            if (!atomic_exchange(&w->queued, true)) {
+                atomic_fetch_add(&w->refs, 1);
+                atomic_fetch_add(&r->inflight, 1);
+                jobs[n].func = rt_dispatch;
+                jobs[n].arg = w;
+                jobs[n].priority = w->pty;
+                n++;
+            }
+        }
+
+        // epoll won't name removed watches again, drop their registrations
+        rt_watch *dead = r->dead;
+        r->dead = null;
+        pthread_mutex_unlock(&r->lock);
+        while (dead != null) {
+            rt_watch *next = dead->next;
+            rt_release(dead);
+            dead = next;
+        }
+
+        // one submission per wakeup, a bounded pool may take it in parts
+        size_t done = 0;
+        while (done < n) {
+            int queued = tp_add_batch(r->pool, jobs + done, n - done);
+            if (queued <= 0) {
+                break;
+            }
+            done += (size_t) queued;
+        }
+
+        // the pool is gone, let the watches be queued again later
+        for (; done < n; done++) {
+            rt_watch *w = (rt_watch *) jobs[done].arg;
+            atomic_store(&w->queued, false);
+            rt_release(w);
+            rt_done(r);
+        }
+    }
+
+    return null;
+}
+
+static void *rt_dispatch(void *arg) {
+    rt_watch *w = (rt_watch *) arg;
+    reactor *r = w->r;
+
+    while (true) {
+        int ev = atomic_exchange(&w->ready, 0);
+        if (ev != 0 && atomic_load(&w->live) && r->shutdown != tpsdown_now) {
+            w->func(w->fd, ev, w->arg);
+        }
+
+        // hand queueing back to the reactor, keep going if events arrived before it could see that
+        atomic_store(&w->queued, false);
+        if (atomic_load(&w->ready) == 0 || atomic_exchange(&w->queued, true)) {
+            break;
+        }
+    }
+
+    rt_release(w);
+    rt_done(r);
+    return null;
+}
+
+static void rt_release(rt_watch *w) {
+    if (atomic_fetch_sub(&w->refs, 1) == 1) {
+        free(w);
+    }
+}
+
+static void rt_done(reactor *r) {
+    // only the last dispatch after rt_dest gets here, the reactor may be freed once the lock is released
+    if (atomic_fetch_sub(&r->inflight, 1) == 1) {
+        pthread_mutex_lock(&r->lock);
+        r->drained = true;
+        pthread_cond_broadcast(&r->notify);
+        pthread_mutex_unlock(&r->lock);
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef REACTOR
+#define REACTOR
+
+#include "defs.h"
+#include "threadpool.h"
+
+typedef enum {
+    rt_invalid = -1,
+    rt_lockfail = -2,
+    rt_shutdown = -3,
+    rt_threadfail = -4,
+    // epoll refused the fd, errno has the reason
+    rt_sysfail = -5
+} err_rt;
+
+typedef enum {
+    rtev_read = 1,
+    rtev_write = 2,
+    // the peer hung up or the fd is in error, reported whether asked for or not
+    rtev_hup = 4,
+    rtev_err = 8
+} rt_events;
+
+// reactor struct, watches fds and runs their callbacks on a threadpool
+typedef struct reactor reactor;
+
+// start a reactor thread feeding 'pool'; return null on failure
+// the pool must outlive the reactor
+extern reactor *rt_init(threadpool *pool);
+
+// watch 'fd' for 'events' (rt_events), edge-triggered; returns 0 on success and an err_rt on failure
+// func(fd, events, arg) runs on a worker with every event seen since its last run, never twice at once for one fd
+// it should read or write until EAGAIN as no further event comes for data already there
+// note: any return value for func is ignored
+extern int rt_add(reactor *r, int fd, int events, void_ptr (*func)(int, int, void_ptr), void_ptr arg, int priority);
+
+// stop watching 'fd'; returns 0 on success and an err_rt on failure
+// a callback already running finishes, one that is queued is skipped
+extern int rt_del(reactor *r, int fd);
+
+// stop the reactor and free it in the manner determined by the flag (sflags_tp)
+// tpsdown_soft lets queued callbacks run, tpsdown_now skips those that haven't started; both wait for running ones
+extern int rt_dest(reactor *r, int flags);
+
+#endif
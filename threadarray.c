@@ -14,6 +14,16 @@ struct threadarray {
     void_ptr *as;
 };
 
+// shared state of the parallel foreach and reduce passes
+typedef struct {
+    threadarray *arr;
+    size_t grain;
+    void_ptr *dest;
+    size_t *counts;
+    void_ptr (*map)(void_ptr);
+    optional (*keep)(void_ptr);
+} tharr_par;
+
 optional tharr_init(size_t m) {
     optional opt;
     opt.e = true;
@@ -254,3 +264,126 @@ int tharr_reduce(threadarray *arr, optional (*func)(void_ptr)) {
         return get_lock_fail;
     }
 }
+
+static void_ptr tharr_par_map(void_ptr ctx, size_t lo, size_t hi) {
+    tharr_par *p = (tharr_par *) ctx;
+    size_t i;
+    for (i = lo; i < hi; i++) {
+        p->arr->as[i] = p->map(p->arr->as[i]);
+    }
+
+    return null;
+}
+
+// filter a chunk in place towards its own start and record how many survived
+static void_ptr tharr_par_filter(void_ptr ctx, size_t lo, size_t hi) {
+    tharr_par *p = (tharr_par *) ctx;
+    size_t i, c = lo;
+    for (i = lo; i < hi; i++) {
+        optional opt = p->keep(p->arr->as[i]);
+        if (opt.e) {
+            p->arr->as[c++] = opt.val;
+        }
+    }
+    p->counts[lo / p->grain] = c - lo;
+
+    return null;
+}
+
+// copy a chunk's survivors to their final offset, counts has been turned into offsets by now
+static void_ptr tharr_par_compact(void_ptr ctx, size_t lo, size_t hi) {
+    tharr_par *p = (tharr_par *) ctx;
+    size_t c = lo / p->grain;
+    size_t n = p->counts[c + 1] - p->counts[c];
+    // the survivors sit at the start of the chunk and never run past it
+    n = n < hi - lo ? n : hi - lo;
+    memcpy(&p->dest[p->counts[c]], &p->arr->as[lo], n * sizeof(void_ptr));
+
+    return null;
+}
+
+int tharr_parallel_foreach(threadarray *arr, threadpool *pool, void_ptr (*func)(void_ptr), size_t grain) {
+    if (pool == null) {
+        return tharr_foreach(arr, func);
+    }
+
+    if (pthread_mutex_lock(&arr->lock) == 0) {
+        tharr_par p;
+        p.arr = arr;
+        p.map = func;
+        // a failed pass runs no chunk at all, so map the whole array here instead
+        if (tp_parallel_for(pool, arr->n, grain, tharr_par_map, &p) != 0) {
+            tharr_par_map(&p, 0, arr->n);
+        }
+
+        pthread_mutex_unlock(&arr->lock);
+        pthread_cond_broadcast(&arr->notify);
+        return no_err;
+    } else {
+        return get_lock_fail;
+    }
+}
+
+int tharr_parallel_reduce(threadarray *arr, threadpool *pool, optional (*func)(void_ptr), size_t grain) {
+    if (pool == null) {
+        return tharr_reduce(arr, func);
+    }
+
+    if (pthread_mutex_lock(&arr->lock) != 0) {
+        return get_lock_fail;
+    }
+
+    if (arr->n == 0) {
+        pthread_mutex_unlock(&arr->lock);
+        return 0;
+    }
+
+    tharr_par p;
+    p.arr = arr;
+    p.keep = func;
+    p.grain = grain == 0 ? tp_grain(pool, arr->n) : grain;
+
+    size_t i, chunks = arr->n / p.grain + (arr->n % p.grain != 0);
+    if ((p.counts = malloc((chunks + 1) * sizeof(size_t))) == null ||
+            (p.dest = malloc(arr->m * sizeof(void_ptr))) == null) {
+        // not enough memory for the parallel pass, fall back to the serial one
+        free(p.counts);
+        pthread_mutex_unlock(&arr->lock);
+        return tharr_reduce(arr, func);
+    }
+
+    // filter each chunk, then turn the survivor counts into output offsets
+    // a failed pass runs no chunk at all, so the serial reduce still sees the original items
+    if (tp_parallel_for(pool, arr->n, p.grain, tharr_par_filter, &p) != 0) {
+        free(p.counts);
+        free(p.dest);
+        pthread_mutex_unlock(&arr->lock);
+        return tharr_reduce(arr, func);
+    }
+
+    size_t off = 0;
+    for (i = 0; i < chunks; i++) {
+        size_t c = p.counts[i];
+        p.counts[i] = off;
+        off += c;
+    }
+    p.counts[chunks] = off;
+
+    // move the survivors into the new backing array in parallel, or here if the pool can't take the pass
+    if (tp_parallel_for(pool, arr->n, p.grain, tharr_par_compact, &p) != 0) {
+        for (i = 0; i < chunks; i++) {
+            size_t lo = i * p.grain;
+            tharr_par_compact(&p, lo, lo + p.grain < arr->n ? lo + p.grain : arr->n);
+        }
+    }
+    memset(&p.dest[off], 0, (arr->m - off) * sizeof(void_ptr));
+
+    free(arr->as);
+    free(p.counts);
+    arr->as = p.dest;
+    arr->n = off;
+
+    pthread_mutex_unlock(&arr->lock);
+    pthread_cond_broadcast(&arr->notify);
+    return (int) off;
+}
@@ -3,6 +3,7 @@
 
 #include "defs.h"
 #include "optional.h"
+#include "threadpool.h"
 
 typedef struct threadarray threadarray;
 
@@ -42,4 +43,11 @@ extern int tharr_foreach(threadarray *arr, void_ptr (*func)(void_ptr));
 // remove the items marked with false by the function, returns the new size of the array
 extern int tharr_reduce(threadarray *arr, optional (*func)(void_ptr));
 
+// tharr_foreach split into chunks of 'grain' items run on the threadpool, a grain of 0 uses tp_grain
+// if the pool can't take the pass the calling thread maps the whole array instead
+extern int tharr_parallel_foreach(threadarray *arr, threadpool *pool, void_ptr (*func)(void_ptr), size_t grain);
+
+// tharr_reduce split into chunks of 'grain' items run on the threadpool, survivors keep their order
+extern int tharr_parallel_reduce(threadarray *arr, threadpool *pool, optional (*func)(void_ptr), size_t grain);
+
 #endif // THREADARRAY
@@ -0,0 +1,308 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "heap.h"
+#include "threadheap.h"
+
+#define THHEAP_CACHE_LINE 64
+
+// one internal heap, its size is mirrored outside the lock so empty heaps can be skipped without locking
+// items are only ever compared with their heaps locked, another thread may pop and free them otherwise
+typedef struct {
+    _Alignas(THHEAP_CACHE_LINE) pthread_mutex_t lock;
+    heap *h;
+    atomic_size_t n;
+} thheap_q;
+
+struct threadheap {
+    const int8_t t;
+    size_t nq;
+    thheap_q *qs;
+    atomic_size_t n;
+
+    bool (*cmp)(void const *, void const *);
+};
+
+// per thread xorshift state for choosing heaps, seeded on first use
+static _Thread_local unsigned thheap_rng = 0;
+
+// random internal heap
+static size_t thheap_pick(threadheap *h);
+
+// lock a random internal heap, trying others before blocking on one
+static thheap_q *thheap_lock_any(threadheap *h);
+
+// refresh the mirrored size, called with the heap's lock held
+static void thheap_sync(thheap_q *q);
+
+threadheap *thheap_init(size_t m, size_t nq, bool (*cmp)(void const *, void const *)) {
+    threadheap *h;
+    if ((h = malloc(sizeof(threadheap))) == null) {
+        return null;
+    }
+
+    if (nq == 0) {
+        long conf = sysconf(_SC_NPROCESSORS_ONLN);
+        nq = conf > 0 ? 2 * (size_t) conf : 2;
+    }
+    if ((h->qs = aligned_alloc(THHEAP_CACHE_LINE, nq * sizeof(thheap_q))) == null) {
+        free(h);
+        return null;
+    }
+
+    size_t i;
+    for (i = 0; i < nq; i++) {
+        if ((h->qs[i].h = h_init(m, cmp)) == null) {
+            break;
+        }
+        if (pthread_mutex_init(&h->qs[i].lock, null) != 0) {
+            h_free(h->qs[i].h);
+            break;
+        }
+        atomic_init(&h->qs[i].n, 0);
+    }
+    if (i < nq) {
+        while (i-- > 0) {
+            pthread_mutex_destroy(&h->qs[i].lock);
+            h_free(h->qs[i].h);
+        }
+        free(h->qs);
+        free(h);
+        return null;
+    }
+
+    *((int8_t *) h) = 7;
+    h->nq = nq;
+    h->cmp = cmp;
+    atomic_init(&h->n, 0);
+
+    return h;
+}
+
+void thheap_free(threadheap *h) {
+    size_t i;
+    for (i = 0; i < h->nq; i++) {
+        pthread_mutex_destroy(&h->qs[i].lock);
+        h_free(h->qs[i].h);
+    }
+    free(h->qs);
+    free(h);
+}
+
+bool thheap_push(threadheap *h, void_ptr a) {
+    thheap_q *q;
+    if ((q = thheap_lock_any(h)) == null) {
+        return false;
+    }
+
+    bool ok = h_push(q->h, a);
+    if (ok) {
+        thheap_sync(q);
+        atomic_fetch_add(&h->n, 1);
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    return ok;
+}
+
+void_ptr thheap_peek(threadheap *h) {
+    // lock in index order, keeping the heap with the best top so far locked so that top can't be freed
+    thheap_q *best = null;
+    size_t i;
+    for (i = 0; i < h->nq; i++) {
+        thheap_q *q = &h->qs[i];
+        if (atomic_load(&q->n) == 0 || pthread_mutex_lock(&q->lock) != 0) {
+            continue;
+        }
+        if (!h_empty(q->h) && (best == null || h->cmp(h_peek(q->h), h_peek(best->h)))) {
+            if (best != null) {
+                pthread_mutex_unlock(&best->lock);
+            }
+            best = q;
+        } else {
+            pthread_mutex_unlock(&q->lock);
+        }
+    }
+
+    void_ptr a = null;
+    if (best != null) {
+        a = h_peek(best->h);
+        pthread_mutex_unlock(&best->lock);
+    }
+
+    return a;
+}
+
+void_ptr thheap_pop(threadheap *h) {
+    void_ptr a;
+    return thheap_pop_k(h, &a, 1) == 1 ? a : null;
+}
+
+size_t thheap_pop_k(threadheap *h, void_ptr *as, size_t k) {
+    size_t got = 0, misses = 0;
+
+    while (got < k && atomic_load(&h->n) > 0) {
+        thheap_q *x = &h->qs[thheap_pick(h)];
+        thheap_q *y = &h->qs[thheap_pick(h)];
+        if (atomic_load(&x->n) == 0) {
+            x = y;
+        } else if (atomic_load(&y->n) == 0) {
+            y = x;
+        }
+
+        if (atomic_load(&x->n) == 0) {
+            // both choices looked empty, sweep every heap before giving up
+            if (++misses < 2) {
+                continue;
+            }
+            thheap_q *c = null;
+            size_t i, start = thheap_pick(h);
+            for (i = 0; i < h->nq && c == null; i++) {
+                c = &h->qs[(start + i) % h->nq];
+                c = atomic_load(&c->n) != 0 ? c : null;
+            }
+            if (c == null || pthread_mutex_lock(&c->lock) != 0) {
+                break;
+            }
+            x = y = c;
+        } else if (pthread_mutex_trylock(&x->lock) != 0) {
+            // someone else is on it, settle for the other choice or choose again rather than queue up
+            if (y == x || pthread_mutex_trylock(&y->lock) != 0) {
+                continue;
+            }
+            x = y;
+        } else if (y != x && pthread_mutex_trylock(&y->lock) != 0) {
+            y = x;
+        }
+
+        // with both locked take the better top each time, never blocking while holding a lock
+        size_t taken = 0;
+        while (got < k) {
+            thheap_q *q = h_empty(x->h) ? y : h_empty(y->h) ? x : h->cmp(h_peek(y->h), h_peek(x->h)) ? y : x;
+            if (h_empty(q->h)) {
+                break;
+            }
+            as[got++] = h_pop(q->h);
+            taken++;
+        }
+        thheap_sync(x);
+        pthread_mutex_unlock(&x->lock);
+        if (y != x) {
+            thheap_sync(y);
+            pthread_mutex_unlock(&y->lock);
+        }
+
+        if (taken > 0) {
+            atomic_fetch_sub(&h->n, taken);
+            misses = 0;
+        }
+    }
+
+    return got;
+}
+
+bool thheap_empty(threadheap *h) {
+    return atomic_load(&h->n) == 0;
+}
+
+size_t thheap_size(threadheap *h) {
+    return atomic_load(&h->n);
+}
+
+bool thheap_concat(threadheap *dest, threadheap *src) {
+    if (dest == null || src == null || dest == src) {
+        return false;
+    }
+
+    // hand each source heap whole to one destination heap, spreading them round robin
+    size_t i;
+    for (i = 0; i < src->nq; i++) {
+        thheap_q *s = &src->qs[i];
+        thheap_q *d = &dest->qs[i % dest->nq];
+        size_t n = h_size(s->h);
+        if (n == 0) {
+            continue;
+        }
+        if (pthread_mutex_lock(&d->lock) != 0) {
+            return false;
+        }
+        bool ok = h_concat(d->h, s->h);
+        if (ok) {
+            s->h = null;
+            thheap_sync(d);
+            atomic_fetch_add(&dest->n, n);
+            atomic_fetch_sub(&src->n, n);
+        }
+        pthread_mutex_unlock(&d->lock);
+        if (!ok) {
+            return false;
+        }
+    }
+
+    for (i = 0; i < src->nq; i++) {
+        pthread_mutex_destroy(&src->qs[i].lock);
+        if (src->qs[i].h != null) {
+            h_free(src->qs[i].h);
+        }
+    }
+    free(src->qs);
+    free(src);
+
+    return true;
+}
+
+void thheap_foreach(threadheap *h, void_ptr (*func)(void_ptr)) {
+    size_t i;
+    for (i = 0; i < h->nq; i++) {
+        thheap_q *q = &h->qs[i];
+        if (pthread_mutex_lock(&q->lock) == 0) {
+            h_foreach(q->h, func);
+            thheap_sync(q);
+            pthread_mutex_unlock(&q->lock);
+        }
+    }
+}
+
+size_t thheap_reduce(threadheap *h, bool (*func)(void_ptr)) {
+    size_t i;
+    for (i = 0; i < h->nq; i++) {
+        thheap_q *q = &h->qs[i];
+        if (pthread_mutex_lock(&q->lock) == 0) {
+            size_t before = h_size(q->h);
+            atomic_fetch_sub(&h->n, before - h_reduce(q->h, func));
+            thheap_sync(q);
+            pthread_mutex_unlock(&q->lock);
+        }
+    }
+
+    return atomic_load(&h->n);
+}
+
+static size_t thheap_pick(threadheap *h) {
+    if (thheap_rng == 0) {
+        thheap_rng = (unsigned) (uintptr_t) &thheap_rng * 2654435761u | 1;
+    }
+    thheap_rng ^= thheap_rng << 13;
+    thheap_rng ^= thheap_rng >> 17;
+    thheap_rng ^= thheap_rng << 5;
+    return thheap_rng % h->nq;
+}
+
+static thheap_q *thheap_lock_any(threadheap *h) {
+    size_t i;
+    for (i = 0; i < h->nq; i++) {
+        thheap_q *q = &h->qs[thheap_pick(h)];
+        if (pthread_mutex_trylock(&q->lock) == 0) {
+            return q;
+        }
+    }
+
+    thheap_q *q = &h->qs[thheap_pick(h)];
+    return pthread_mutex_lock(&q->lock) == 0 ? q : null;
+}
+
+static void thheap_sync(thheap_q *q) {
+    atomic_store(&q->n, h_size(q->h));
+}
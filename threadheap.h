@@ -0,0 +1,46 @@
+#ifndef THREADHEAP
+#define THREADHEAP
+
+#include <stddef.h>
+#include "defs.h"
+
+// concurrent priority queue spread over several locked heaps (a MultiQueue)
+// pops take the better top of two random heaps, so they return one of the best items rather than the best;
+// the rank error grows with the number of heaps, not with the number of threads
+typedef struct threadheap threadheap;
+
+// initialize the heap with 'nq' internal heaps of room 'm' each, 0 picks twice the number of cpus
+extern threadheap *thheap_init(size_t m, size_t nq, bool (*cmp)(void const *, void const *));
+
+// free the memory used by the heap
+extern void thheap_free(threadheap *h);
+
+// insert an item into the heap, return true if successful
+extern bool thheap_push(threadheap *h, void_ptr a);
+
+// peek the best of the internal tops, locking each heap in turn; it may already be gone by the time it returns
+extern void_ptr thheap_peek(threadheap *h);
+
+// pop one of the top items, null only once every internal heap was seen empty
+extern void_ptr thheap_pop(threadheap *h);
+
+// pop up to 'k' top items into 'as' under as few locks as possible, returns how many were popped
+extern size_t thheap_pop_k(threadheap *h, void_ptr *as, size_t k);
+
+// returns whether the heap is empty
+extern bool thheap_empty(threadheap *h);
+
+// number of items in the heap
+extern size_t thheap_size(threadheap *h);
+
+// move the items of the src heap into the dest heap and free src, both must share the comparison function
+// NOTE: src must no longer be in use by other threads
+extern bool thheap_concat(threadheap *dest, threadheap *src);
+
+// applies the function to each of the elements in the heap, one internal heap at a time
+extern void thheap_foreach(threadheap *h, void_ptr (*func)(void_ptr));
+
+// remove the items marked as false by the function, returns the new size of the heap
+extern size_t thheap_reduce(threadheap *h, bool (*func)(void_ptr));
+
+#endif // THREADHEAP
@@ -1,34 +1,345 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <ucontext.h>
+#include <sys/mman.h>
 
 #include "threadpool.h"
-#include "heap.h"
+#include "kheap.h"
+
+#define TP_CACHE_LINE 64
+#define TP_DEQUE_SIZE 64
+#define TP_SLAB_CHUNK 64
+#define TP_SLAB_CACHE 256
+#define TP_SLAB_BATCH 32
+#define TP_GRAIN_SPLIT 8
+#define TP_IDLE_MS 1000
+#define TP_SPIN_CHECK 64
+#define TP_TICK_NS 1000000
+#define TP_WHEEL_BITS 6
+#define TP_WHEEL_SLOTS (1 << TP_WHEEL_BITS)
+#define TP_WHEEL_LEVELS 4
+#define TP_FIBER_CACHE 16
+// submission timeouts, in ms otherwise
+#define TP_WAIT_FOREVER -1
+#define TP_NO_WAIT 0
+#define TP_UNBOUNDED -2
+#define TP_MAX_NODES 64
+
+typedef struct tp_slab tp_slab;
+
+// continuation run by the thread that resolves a future, 'fire' owns and frees the continuation
+typedef struct tp_cont tp_cont;
+struct tp_cont {
+    void (*fire)(tp_cont *c, void *ret, bool cancelled);
+};
+
+struct tp_token {
+    atomic_bool cancelled;
+    // the caller's reference plus one per queued task
+    atomic_size_t refs;
+};
 
 struct tp_future {
+    tp_future *next;
+    tp_slab *slab;
     pthread_mutex_t lock;
     pthread_cond_t notify;
     bool done;
+    // the task never ran, 'ret' is null
+    bool cancelled;
     void *ret;
+    // set when the future was handed to tp_then or a combinator instead of tp_await
+    tp_cont *cont;
 };
 
 // task to store in the queue
-typedef struct {
+typedef struct tp_task tp_task;
+struct tp_task {
+    tp_task *next;
+    // monotonic submission time in ns, only stamped when stats are on
+    uint64_t enq;
     int pty;
     void *(*func)(void *);
     void *arg;
     tp_future *fut;
-} tp_task;
+    // skip the task at dequeue when the token is cancelled or the monotonic deadline in ns has passed
+    tp_token *token;
+    uint64_t deadline;
+};
+
+// shared state of a tp_parallel_for call, freed by whichever of the caller and the helpers finishes last
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t notify;
+    atomic_size_t next;
+    atomic_size_t refs;
+    size_t n;
+    size_t grain;
+    size_t chunks;
+    size_t done;
+    void *(*body)(void *, size_t, size_t);
+    void *ctx;
+} tp_range;
+
+// tp_then continuation, submits func(ret) with 'out' as its future
+typedef struct {
+    tp_cont c;
+    threadpool *pool;
+    void *(*func)(void *);
+    int pty;
+    tp_future *out;
+} tp_then_cont;
+
+typedef struct tp_join tp_join;
+
+// one continuation per input future of tp_when_all and tp_when_any
+typedef struct {
+    tp_cont c;
+    tp_join *j;
+    size_t i;
+} tp_join_cont;
+
+// shared state of tp_when_all and tp_when_any, freed by the last input to resolve
+struct tp_join {
+    atomic_size_t left;
+    atomic_bool fired;
+    void **rets;
+    tp_future *out;
+    tp_join_cont cs[];
+};
+
+// recycled tasks and futures are chained through their leading next pointer
+typedef struct tp_link tp_link;
+struct tp_link {
+    tp_link *next;
+};
+
+typedef struct {
+    tp_link *head;
+    size_t n;
+} tp_freelist;
+
+// block of objects carved up by the slab, futures are initialized once when the chunk is made
+typedef struct tp_chunk tp_chunk;
+struct tp_chunk {
+    tp_chunk *next;
+    bool futs;
+    max_align_t objs[];
+};
+
+// pool-owned allocator for tasks and futures, kept alive until the pool and every future are released
+struct tp_slab {
+    pthread_mutex_t lock;
+    atomic_size_t refs;
+    tp_freelist tasks;
+    tp_freelist futs;
+    tp_chunk *chunks;
+    size_t task_hits;
+    size_t task_misses;
+    size_t fut_hits;
+    size_t fut_misses;
+};
+
+// ring buffer backing a work-stealing deque, old buffers are kept until the pool is freed
+typedef struct tp_dqbuf tp_dqbuf;
+struct tp_dqbuf {
+    long size;
+    tp_dqbuf *prev;
+    _Atomic(tp_task *) as[];
+};
+
+// Chase-Lev deque, the owner pushes and takes at the bottom, thieves steal from the top
+typedef struct {
+    _Alignas(TP_CACHE_LINE) atomic_long top;
+    _Alignas(TP_CACHE_LINE) atomic_long bottom;
+    _Atomic(tp_dqbuf *) buf;
+} tp_deque;
+
+// shared task queue, one per NUMA node when numa_queues is set
+typedef struct {
+    _Alignas(TP_CACHE_LINE) pthread_mutex_t lock;
+    // tpq_heap, keyed by q_key so equal priorities pop in the order they were pushed
+    kheap *tasks;
+    uint32_t seq;
+    // tpq_buckets, FIFOs linked through tp_task.next with bit i of 'bits' set when bucket i is non-empty
+    tp_task *head[TP_BUCKETS];
+    tp_task *tail[TP_BUCKETS];
+    uint32_t bits;
+    unsigned aging;
+    unsigned pops;
+    // tasks queued and the highest priority among them, which is only meaningful while 'len' is non-zero
+    atomic_size_t len;
+    atomic_int top_pty;
+} tp_queue;
+
+// lifecycle of a worker slot, guarded by the pool lock
+typedef enum {
+    tpw_free = 0,
+    tpw_live,
+    tpw_retired
+} tp_wstate;
+
+// per-worker counters, written only by the owner and kept on their own cache lines
+typedef struct {
+    _Alignas(TP_CACHE_LINE) atomic_size_t tasks_run;
+    atomic_size_t steals;
+    atomic_size_t wakeups;
+    atomic_size_t spurious;
+    atomic_uint_fast64_t busy_ns;
+    atomic_uint_fast64_t alive_ns;
+    atomic_uint_fast64_t start_ns;
+    atomic_size_t wait_hist[TP_HIST_BUCKETS];
+    atomic_size_t run_hist[TP_HIST_BUCKETS];
+} tp_wstats;
+
+// an armed timer, linked into a wheel slot by index so the table can grow
+typedef struct {
+    void_ptr (*func)(void_ptr);
+    void_ptr arg;
+    int pty;
+    // due tick and the period in ticks, 0 for one-shot timers
+    uint64_t expiry;
+    uint64_t period;
+    // bumped on every release so stale handles are refused
+    uint32_t gen;
+    // wheel slot, -1 when the entry is free; 'next' doubles as the freelist link
+    int32_t slot;
+    int32_t prev;
+    int32_t next;
+} tp_tentry;
+
+// hierarchical timer wheel of TP_WHEEL_LEVELS levels of TP_WHEEL_SLOTS slots, one tick is TP_TICK_NS
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t notify;
+    pthread_t t;
+    bool started;
+    tp_tentry *es;
+    size_t num_es;
+    size_t max_es;
+    int32_t free;
+    size_t armed;
+    // the wheel has processed every tick up to 'cur', counted from 'base'
+    uint64_t base;
+    uint64_t cur;
+    // tick the timer thread sleeps until, UINT64_MAX while it waits for a timer to be armed
+    uint64_t wake;
+    int32_t slots[TP_WHEEL_LEVELS * TP_WHEEL_SLOTS];
+    // jobs that fell due in one pass, submitted as a batch
+    tp_job *due;
+    size_t max_due;
+} tp_wheel;
+
+typedef struct tp_worker tp_worker;
+
+// a task's own stack and context, recycled across tasks
+typedef struct tp_fiber tp_fiber;
+struct tp_fiber {
+    // resumes the fiber once the awaited future resolves, kept first so the continuation is the fiber
+    tp_cont c;
+    tp_fiber *next;
+    // every fiber of the pool, so stacks of fibers stranded by a shutdown are still released
+    tp_fiber *all;
+    threadpool *pool;
+    // the worker running the fiber, set by the scheduler before every switch to it
+    tp_worker *w;
+    ucontext_t ctx;
+    void *stack;
+    // the task running on the fiber, null once it has finished
+    tp_task *task;
+    // set by tp_await before switching out, the scheduler registers the continuation
+    tp_future *wait;
+    tp_task *resume;
+    void *ret;
+    bool cancelled;
+};
+
+// per-thread worker state
+struct tp_worker {
+    tp_deque dq;
+    threadpool *pool;
+    pthread_t t;
+    int state;
+    size_t id;
+    // cpu the slot is pinned to (-1 for none) and the queue it prefers
+    int cpu;
+    size_t node;
+    unsigned rng;
+    // slab objects cached by this worker, only touched by the owner
+    tp_freelist tasks;
+    tp_freelist futs;
+    atomic_size_t task_hits;
+    atomic_size_t fut_hits;
+    // scheduler context fibers switch back to, the fiber running on the worker, and fibers cached by the owner
+    ucontext_t sched;
+    tp_fiber *fiber;
+    tp_fiber *fibers;
+    size_t num_fibers;
+    tp_wstats st;
+};
 
 struct threadpool {
+    // parking lot for idle workers, and for submitters throttled by a full bounded queue
     pthread_mutex_t lock;
     pthread_cond_t notify;
-    pthread_t *ts;
-    heap *tasks;
-    size_t num_ts;
+    pthread_cond_t space;
+    size_t capacity;
+    atomic_size_t throttled;
+    // shared task queues, the only queues in tpsched_heap mode
+    tp_queue *qs;
+    size_t num_qs;
+    // queue index of every cpu id, used to route outside submissions to the submitter's node
+    size_t *cpu_node;
+    size_t num_cpus;
+    tp_slab *slab;
+    tp_worker *ws;
+    // initialized worker slots and running threads
+    size_t num_ws;
+    atomic_size_t num_ts;
     size_t started;
-    bool shutdown;
+    // elastic sizing, the pool grows while the backlog per thread is above grow_backlog
+    size_t min_ts;
+    size_t max_ts;
+    size_t grow_backlog;
+    unsigned idle_ms;
+    uint64_t spin_ns;
+    size_t grown;
+    size_t shrunk;
+    int sched;
+    // tasks queued but not yet picked up by a worker, and the most there has ever been
+    atomic_size_t pending;
+    atomic_size_t depth_hwm;
+    bool stats;
+    // workers sleeping on notify
+    atomic_size_t parked;
+    atomic_int shutdown;
+    // tasks skipped at dequeue
+    atomic_size_t cancelled;
+    atomic_size_t expired;
+    // delayed and periodic tasks, the timer thread starts with the first timer
+    tp_wheel wheel;
+    // fiber mode, stacks are shared through 'fibers' once the worker caches are full
+    size_t fiber_stack;
+    pthread_mutex_t fiber_lock;
+    tp_fiber *fibers;
+    tp_fiber *fiber_all;
+    // fibers waiting on a future, a soft shutdown waits for them
+    atomic_size_t suspended;
 };
 
+// the worker running on the current thread, null outside of the pool
+static _Thread_local tp_worker *tp_self = null;
+
 // worker thread for the threadpool
 static void *tp_thread(void *arg);
 
@@ -38,276 +349,2533 @@ int tp_free(threadpool *pool);
 // function to cleanup futures
 void *tp_future_free(void *fut);
 
-// comparison function for task priority
-bool tp_taskcomp(void const *lhs, void const *rhs);
+// take a fresh future from the pool's slab, null on failure
+static tp_future *tp_future_new(threadpool *pool, tp_worker *w);
+
+// publish the result or the cancellation of a future, wake its waiters and run its continuation
+static void tp_resolve(tp_future *fut, void *ret, bool cancelled);
+
+// run the continuation once the future resolves, immediately if it already has; consumes the future
+static void tp_future_then(tp_future *fut, tp_cont *c);
+
+// queue a task on the shared heap or the local deque and wake a worker if one is parked
+// 'timeout_ms' is how long to wait for room in a bounded pool, or one of the TP_ timeouts
+static int tp_submit(threadpool *pool, tp_task *task, long timeout_ms);
+
+// queue 'n' tasks at once, returns the number queued or an err_tp if none were
+static int tp_submit_many(threadpool *pool, tp_task **tasks, size_t n, long timeout_ms);
+
+// tp_submit_many without the shutdown check or the bound, for work the pool already owns
+// 'counted' is set when the tasks are already included in pending
+static int tp_enqueue(threadpool *pool, tp_task **tasks, size_t n, bool counted);
+
+// count up to 'n' tasks into pending within the capacity, waiting up to 'timeout_ms'; returns the number counted
+static size_t tp_reserve(threadpool *pool, size_t n, long timeout_ms);
+
+// count 'n' tasks out of pending and let throttled submitters know there is room
+static void tp_taken(threadpool *pool, size_t n);
+
+// shared implementation of tp_add, tp_try_add and tp_add_timed
+static int tp_add_wait(threadpool *pool, void_ptr (*func)(void_ptr), void_ptr arg, int priority, long timeout_ms);
+
+// wake up to 'n' parked workers
+static void tp_wake(threadpool *pool, size_t n);
+
+// shared implementation of tp_add_batch and tp_promise_batch, 'futs' is null for tp_add_batch
+static int tp_batch(threadpool *pool, tp_job const *jobs, size_t n, tp_future **futs, long timeout_ms);
+
+// read the cpu and node layout and assign a cpu and queue to every worker slot
+static bool tp_topo(threadpool *pool, tp_opts const *opts);
+
+// queue submissions from the calling thread should go to
+static size_t tp_home(threadpool *pool);
+
+// shared queue operations
+static bool q_init(tp_queue *q, int kind, unsigned aging);
+static size_t q_push_many(tp_queue *q, tp_task **tasks, size_t n);
+static tp_task *q_pop(tp_queue *q);
+
+// start a thread in a free or retired slot, called with the pool lock held
+static bool tp_spawn(threadpool *pool);
+
+// add a worker if the backlog calls for it and the pool is below max_ts
+static void tp_grow(threadpool *pool);
+
+// find the next task for the worker without blocking, return null if none was found
+static tp_task *tp_next(threadpool *pool, tp_worker *w);
+
+// monotonic clock in ns
+static uint64_t tp_now(void);
+
+// timer wheel operations, called with the wheel lock held except for tw_init and tw_free
+static bool tw_init(tp_wheel *wh);
+static void tw_free(tp_wheel *wh);
+static void tw_link(tp_wheel *wh, int32_t i);
+static void tw_unlink(tp_wheel *wh, int32_t i);
+static void tw_tick(threadpool *pool, tp_wheel *wh, size_t *n);
+static uint64_t tw_next(tp_wheel *wh);
+static tp_timer tw_arm(threadpool *pool, uint64_t delay_ms, uint64_t period_ms, void_ptr (*func)(void_ptr),
+        void_ptr arg, int priority);
+
+// timer thread, moves due timers into the task queue
+static void *tp_timer_thread(void *arg);
+
+// tp_parallel_for helper task, and the release of one reference to its range
+static void *tp_range_run(void *arg);
+static void tp_range_unref(tp_range *r);
+
+// poll for work for up to spin_ns before parking, return true if work showed up
+static bool tp_spin(threadpool *pool);
+
+// add to a counter only its owner writes, cheaper than an atomic read-modify-write
+static void tp_bump(atomic_size_t *c, size_t n);
+
+// histogram bucket of a value in ns
+static size_t tp_hist_bucket(uint64_t v);
+
+// run the task, resolve its future and recycle it
+static void tp_run(threadpool *pool, tp_worker *w, tp_task *task);
+
+// the body of tp_run, called on a fiber in fiber mode
+static void tp_exec(threadpool *pool, tp_worker *w, tp_task *task);
+
+// the worker running on the current thread, never cached across a fiber switch
+static tp_worker *tp_current(void);
+
+// fiber operations, fibers are taken and returned by the worker running them
+static tp_fiber *fiber_get(threadpool *pool, tp_worker *w);
+static bool fiber_ctx(threadpool *pool, tp_fiber *f, size_t page);
+static void fiber_put(threadpool *pool, tp_worker *w, tp_fiber *f);
+static void fiber_main(void);
+static void fiber_fire(tp_cont *c, void *ret, bool cancelled);
+
+// run the fiber until it finishes or suspends, then register its continuation if it suspended
+static void tp_switch(threadpool *pool, tp_worker *w, tp_fiber *f);
+
+// marker function of the tasks that resume a suspended fiber, the fiber is the argument
+static void *tp_resume(void *arg);
+
+// slab allocator operations, 'w' is the calling worker or null
+static tp_slab *slab_init(void);
+static void slab_unref(tp_slab *s);
+static void *slab_get(tp_slab *s, tp_worker *w, bool fut);
+static bool slab_get_many(tp_slab *s, tp_worker *w, bool fut, void **as, size_t n);
+static void slab_put(tp_slab *s, tp_worker *w, bool fut, void *a);
+
+// the calling worker if it belongs to the pool that owns the slab, null otherwise
+static tp_worker *slab_worker(tp_slab *s);
+
+// work-stealing deque operations
+static bool dq_init(tp_deque *dq, long size);
+static void dq_free(tp_deque *dq);
+static bool dq_push(tp_deque *dq, tp_task *task);
+static tp_task *dq_take(tp_deque *dq);
+static tp_task *dq_steal(tp_deque *dq);
 
 threadpool *tp_init(size_t num_ts) {
+    tp_opts opts = {0};
+    opts.num_ts = num_ts;
+    opts.sched = tpsched_heap;
+
+    return tp_init_opts(&opts);
+}
+
+threadpool *tp_init_opts(tp_opts const *opts) {
     threadpool *pool;
-    if ((pool = (threadpool *) malloc(sizeof(threadpool))) == null) {
-        goto err;
+    if (opts == null || opts->num_ts == 0 ||
+            (pool = (threadpool *) malloc(sizeof(threadpool))) == null) {
+        return null;
     }
 
     // init the pool
+    pool->num_ws = 0;
     pool->num_ts = 0;
-    pool->shutdown = false;
+    pool->shutdown = 0;
     pool->started = 0;
-    pool->tasks = h_init(32, tp_taskcomp);
+    pool->sched = opts->sched;
+    pool->stats = opts->stats;
+    pool->depth_hwm = 0;
+    pool->pending = 0;
+    pool->parked = 0;
+    pool->capacity = opts->capacity;
+    pool->throttled = 0;
+    pool->cancelled = 0;
+    pool->expired = 0;
+    pool->min_ts = opts->num_ts;
+    pool->max_ts = opts->max_ts > opts->num_ts ? opts->max_ts : opts->num_ts;
+    pool->grow_backlog = opts->grow_backlog == 0 ? 1 : opts->grow_backlog;
+    pool->idle_ms = opts->idle_ms == 0 ? TP_IDLE_MS : opts->idle_ms;
+    pool->spin_ns = (uint64_t) opts->spin_us * 1000;
+    pool->grown = pool->shrunk = 0;
+    pool->qs = null;
+    pool->num_qs = 0;
+    pool->cpu_node = null;
+    pool->num_cpus = 0;
+    pool->slab = slab_init();
+    pool->fiber_stack = 0;
+    pool->fibers = pool->fiber_all = null;
+    pool->suspended = 0;
+    if (opts->fiber_stack > 0) {
+        // whole pages plus a guard page below the stack
+        size_t page = (size_t) sysconf(_SC_PAGESIZE);
+        pool->fiber_stack = (opts->fiber_stack + page - 1) / page * page + page;
+    }
 
-    pool->ts = malloc(sizeof(pthread_t) * num_ts);
+    // every slot the pool may ever grow into is set up front so thieves can scan them freely
+    pool->ws = aligned_alloc(TP_CACHE_LINE, sizeof(tp_worker) * pool->max_ts);
 
     // setup mutex and conditional notification
-    if (pthread_mutex_init(&pool->lock, null) != 0 ||
+    if (!tw_init(&pool->wheel) ||
+            pthread_mutex_init(&pool->lock, null) != 0 ||
             pthread_cond_init(&pool->notify, null) != 0 ||
-            pool->ts == null) {
+            pthread_cond_init(&pool->space, null) != 0 ||
+            pthread_mutex_init(&pool->fiber_lock, null) != 0 ||
+            pool->ws == null || pool->slab == null) {
+        goto err;
+    }
+
+    // lay out the queues and worker placement before any worker exists
+    if (!tp_topo(pool, opts)) {
         goto err;
     }
 
-    // spin up worker threads
     size_t i;
-    for (i = 0; i < num_ts; i++) {
-        if (pthread_create(&pool->ts[i], null, tp_thread, (void *) pool) != 0) {
-            tp_dest(pool, 0);
+    for (i = 0; i < pool->max_ts; i++) {
+        tp_worker *w = &pool->ws[i];
+        w->pool = pool;
+        w->state = tpw_free;
+        w->id = i;
+        w->rng = (unsigned) i * 2654435761u + 1;
+        w->tasks.head = w->futs.head = null;
+        w->tasks.n = w->futs.n = 0;
+        atomic_init(&w->task_hits, 0);
+        atomic_init(&w->fut_hits, 0);
+        memset(&w->st, 0, sizeof(tp_wstats));
+        w->fiber = w->fibers = null;
+        w->num_fibers = 0;
+        if (!dq_init(&w->dq, pool->sched == tpsched_steal ? TP_DEQUE_SIZE : 0)) {
+            goto err;
+        }
+        pool->num_ws++;
+    }
+
+    // spin up worker threads
+    pthread_mutex_lock(&pool->lock);
+    for (i = 0; i < opts->num_ts; i++) {
+        if (!tp_spawn(pool)) {
+            // join the started workers and release everything
+            pthread_mutex_unlock(&pool->lock);
+            tp_dest(pool, tpexit_now);
             return null;
         }
-        pool->num_ts++;
-        pool->started++;
     }
+    pool->grown = 0;
+    pthread_mutex_unlock(&pool->lock);
 
     return pool;
 
     err:
     // initialization has failed somewhere, cleanup and return null
-    if (pool) {
-        tp_free(pool);
-    }
+    tp_free(pool);
     return null;
 }
 
 int tp_add(threadpool *pool, void *(*func)(void *), void *arg, int priority) {
-    int err = 0;
+    return tp_add_wait(pool, func, arg, priority, TP_WAIT_FOREVER);
+}
+
+int tp_try_add(threadpool *pool, void *(*func)(void *), void *arg, int priority) {
+    return tp_add_wait(pool, func, arg, priority, TP_NO_WAIT);
+}
+
+int tp_add_timed(threadpool *pool, void *(*func)(void *), void *arg, int priority, uint64_t timeout_ms) {
+    return tp_add_wait(pool, func, arg, priority, timeout_ms > LONG_MAX ? TP_WAIT_FOREVER : (long) timeout_ms);
+}
 
+static int tp_add_wait(threadpool *pool, void *(*func)(void *), void *arg, int priority, long timeout_ms) {
     if (pool == null || func == null) {
         return tp_invalid;
     }
 
-    // wait for lock on the queue, quit if lock fails
-    if (pthread_mutex_lock(&pool->lock) != 0) {
+    tp_worker *w = slab_worker(pool->slab);
+    tp_task *task;
+    if ((task = slab_get(pool->slab, w, false)) == null) {
         return tp_lockfail;
     }
-
-    // check for shutdown
-    if (pool->shutdown) {
-
-        tp_task *task = malloc(sizeof(tp_task));
-        task->func = func;
-        task->arg = arg;
-        task->pty = priority;
-        task->fut = null;
-
-        h_push(pool->tasks, task);
-
-        // send notification that the queue is unlocking
-        if (pthread_cond_signal(&pool->notify) != 0) {
-            err = tp_lockfail;
-        }
-    } else {
-        err = tp_shutdown;
-    }
-
-    if (pthread_mutex_unlock(&pool->lock) != 0) {
-        err = tp_lockfail;
+    task->func = func;
+    task->arg = arg;
+    task->pty = priority;
+    task->fut = null;
+    task->token = null;
+    task->deadline = 0;
+
+    int err;
+    if ((err = tp_submit(pool, task, timeout_ms)) != 0) {
+        slab_put(pool->slab, w, false, task);
     }
 
     return err;
 }
 
-tp_future *tp_promise(threadpool *pool, void *func, void *arg, int priority) {
-    int err = 0;
+tp_future *tp_promise(threadpool *pool, void *(*func)(void *), void *arg, int priority) {
     tp_future *fut = null;
 
     if (pool == null || func == null) {
         return null;
     }
 
-    // wait for lock on the queue, quit if lock fails
-    if (pthread_mutex_lock(&pool->lock) != 0) {
-        return fut;
-    }
-
-    // check for shutdown
-    if (!pool->shutdown) {
-        tp_task *task = malloc(sizeof(tp_task));
-        task->func = func;
-        task->arg = arg;
-        task->pty = priority;
-
-        // initialize the future
-        fut = malloc(sizeof(tp_future));
-        pthread_mutex_init(&fut->lock, null);
-        pthread_cond_init(&fut->notify, null);
-        task->fut = fut;
-
-        // push the task to the queue
-        h_push(pool->tasks, task);
-
-        // send notification that the queue is unlocking
-        if (pthread_cond_signal(&pool->notify) != 0) {
-            err = tp_lockfail;
-        }
-    } else {
-        err = tp_shutdown;
+    tp_worker *w = slab_worker(pool->slab);
+    tp_task *task;
+    if ((task = slab_get(pool->slab, w, false)) == null) {
+        return null;
     }
-
-
-    if (pthread_mutex_unlock(&pool->lock) != 0) {
-        err = tp_lockfail;
+    task->func = func;
+    task->arg = arg;
+    task->pty = priority;
+    task->token = null;
+    task->deadline = 0;
+
+    if ((fut = tp_future_new(pool, w)) == null) {
+        slab_put(pool->slab, w, false, task);
+        return null;
     }
+    task->fut = fut;
 
     // cleanup the future if there has been an error after the future has been created
-    if (err != 0 && fut != null) {
+    if (tp_submit(pool, task, TP_WAIT_FOREVER) != 0) {
+        slab_put(pool->slab, w, false, task);
         fut = tp_future_free(fut);
     }
 
     return fut;
 }
 
-int tp_dest(threadpool *pool, int flags) {
-    int i, err = 0;
+int tp_add_batch(threadpool *pool, tp_job const *jobs, size_t n) {
+    return tp_batch(pool, jobs, n, null, TP_WAIT_FOREVER);
+}
 
-    if (pool == null) {
+int tp_promise_batch(threadpool *pool, tp_job const *jobs, size_t n, tp_future **futs) {
+    if (futs == null) {
         return tp_invalid;
     }
 
-    if (pthread_mutex_lock(&pool->lock) != 0) {
-        return tp_lockfail;
+    return tp_batch(pool, jobs, n, futs, TP_WAIT_FOREVER);
+}
+
+static int tp_batch(threadpool *pool, tp_job const *jobs, size_t n, tp_future **futs, long timeout_ms) {
+    size_t i;
+
+    if (pool == null || jobs == null) {
+        return tp_invalid;
+    }
+    for (i = 0; i < n; i++) {
+        if (jobs[i].func == null) {
+            return tp_invalid;
+        }
+    }
+    if (n == 0) {
+        return 0;
     }
 
-    // check that we're not shutting down already
-    if (!pool->shutdown) {
-        pool->shutdown = (flags & tpexit_graceful) ?
-                tpsdown_soft : tpsdown_now;
+    tp_worker *w = slab_worker(pool->slab);
+    tp_task **tasks;
+    if ((tasks = malloc(n * sizeof(tp_task *))) == null) {
+        return tp_lockfail;
+    }
 
-        // wakeup worker threads
-        if (pthread_cond_broadcast(&pool->notify) != 0 ||
-                pthread_mutex_unlock(&pool->lock) != 0) {
-            err = tp_lockfail;
+    if (!slab_get_many(pool->slab, w, false, (void **) tasks, n)) {
+        free(tasks);
+        return tp_lockfail;
+    }
+    if (futs != null && !slab_get_many(pool->slab, w, true, (void **) futs, n)) {
+        for (i = 0; i < n; i++) {
+            slab_put(pool->slab, w, false, tasks[i]);
         }
+        free(tasks);
+        return tp_lockfail;
+    }
 
-        // recall worker threads
-        for (i = 0; i < pool->num_ts; i++) {
-            if (pthread_join(pool->ts[i], null) != 0) {
-                err = tp_threadfail;
+    if (futs != null) {
+        atomic_fetch_add(&pool->slab->refs, n);
+    }
+    uint64_t now = 0;
+    for (i = 0; i < n; i++) {
+        tasks[i]->func = jobs[i].func;
+        tasks[i]->arg = jobs[i].arg;
+        tasks[i]->pty = jobs[i].priority;
+        tasks[i]->fut = null;
+        tasks[i]->token = jobs[i].token;
+        tasks[i]->deadline = 0;
+        if (jobs[i].token != null) {
+            atomic_fetch_add(&jobs[i].token->refs, 1);
+        }
+        if (jobs[i].deadline_ms != 0) {
+            if (now == 0) {
+                now = tp_now();
             }
+            tasks[i]->deadline = now + jobs[i].deadline_ms * 1000000;
+        }
+        if (futs != null) {
+            futs[i]->slab = pool->slab;
+            futs[i]->done = false;
+            futs[i]->cancelled = false;
+            futs[i]->ret = null;
+            futs[i]->cont = null;
+            tasks[i]->fut = futs[i];
         }
-    } else {
-        err = tp_shutdown;
     }
 
-    // don't free if we hit an error
-    if (!err) {
-        tp_free(pool);
+    // give back whatever could not be queued
+    int queued = tp_submit_many(pool, tasks, n, timeout_ms);
+    for (i = queued < 0 ? 0 : (size_t) queued; i < n; i++) {
+        if (tasks[i]->token != null) {
+            tp_token_free(tasks[i]->token);
+        }
+        slab_put(pool->slab, w, false, tasks[i]);
+        if (futs != null) {
+            futs[i] = tp_future_free(futs[i]);
+        }
     }
-    return err;
+
+    free(tasks);
+    return queued;
 }
 
-int tp_free(threadpool *pool) {
-    if (pool == null || pool->started > 0) {
-        return -1;
+static int tp_submit(threadpool *pool, tp_task *task, long timeout_ms) {
+    int err = tp_submit_many(pool, &task, 1, timeout_ms);
+    return err < 0 ? err : 0;
+}
+
+static int tp_submit_many(threadpool *pool, tp_task **tasks, size_t n, long timeout_ms) {
+    if (pool->shutdown) {
+        return tp_shutdown;
     }
 
-    // release threadpool if it has been created
-    if (pool->ts) {
+    // workers never wait on the bound, they may be the only ones able to make room
+    tp_worker *self = tp_current();
+    if (pool->capacity == 0 || timeout_ms == TP_UNBOUNDED || (self != null && self->pool == pool)) {
+        return tp_enqueue(pool, tasks, n, false);
+    }
+
+    size_t k = tp_reserve(pool, n, timeout_ms);
+    if (k == 0) {
+        return pool->shutdown ? tp_shutdown : tp_full;
+    }
+
+    return tp_enqueue(pool, tasks, k, true);
+}
+
+static size_t tp_reserve(threadpool *pool, size_t n, long timeout_ms) {
+    size_t cap = pool->capacity;
+    size_t k, p = atomic_load(&pool->pending);
+    struct timespec until;
+    bool timed = timeout_ms > 0;
+
+    if (timed) {
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += timeout_ms / 1000;
+        until.tv_nsec += (timeout_ms % 1000) * 1000000;
+        if (until.tv_nsec >= 1000000000) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000;
+        }
+    }
+
+    while (true) {
+        // take as much of the free room as we need
+        while (p < cap) {
+            k = n < cap - p ? n : cap - p;
+            if (atomic_compare_exchange_weak(&pool->pending, &p, p + k)) {
+                return k;
+            }
+        }
+        if (timeout_ms == TP_NO_WAIT || pool->shutdown) {
+            return 0;
+        }
+
+        // announce ourselves before the last check so tp_taken can't miss us
+        bool expired = false;
         pthread_mutex_lock(&pool->lock);
+        atomic_fetch_add(&pool->throttled, 1);
+        while (atomic_load(&pool->pending) >= cap && !pool->shutdown && !expired) {
+            if (!timed) {
+                pthread_cond_wait(&pool->space, &pool->lock);
+            } else {
+                expired = pthread_cond_timedwait(&pool->space, &pool->lock, &until) == ETIMEDOUT;
+            }
+        }
+        atomic_fetch_sub(&pool->throttled, 1);
+        pthread_mutex_unlock(&pool->lock);
 
-        // free the task queue if it has been initialized
-        if (pool->tasks != null) {
-            h_foreach(pool->tasks, tp_future_free);
-            h_free(pool->tasks);
+        p = atomic_load(&pool->pending);
+        if (expired && p >= cap) {
+            return 0;
         }
+    }
+}
+
+static void tp_taken(threadpool *pool, size_t n) {
+    atomic_fetch_sub(&pool->pending, n);
 
-        free(pool->ts);
-        pthread_mutex_destroy(&pool->lock);
-        pthread_cond_destroy(&pool->notify);
+    if (atomic_load(&pool->throttled) > 0 && pthread_mutex_lock(&pool->lock) == 0) {
+        pthread_cond_broadcast(&pool->space);
+        pthread_mutex_unlock(&pool->lock);
     }
-    free(pool);
-    return 0;
 }
 
-static void *tp_thread(void *arg) {
-    threadpool *pool = ((threadpool *) arg);
-    tp_task *task;
+static int tp_enqueue(threadpool *pool, tp_task **tasks, size_t n, bool counted) {
+    tp_worker *self = tp_current();
+    size_t i = 0;
+    int err = tp_lockfail;
 
-    while (true) {
-        // wait for the queue to be free and lock while getting task
-        pthread_mutex_lock(&pool->lock);
+    // count the tasks before publishing them, pairs with the check in tp_thread
+    size_t depth = counted ? atomic_load(&pool->pending) : atomic_fetch_add(&pool->pending, n) + n;
 
-        // wait on condition variable, check for spurious wakeups
-        // we own the lock when returning from pthread_cond_wait
-        while (h_empty(pool->tasks) && !pool->shutdown) {
-            pthread_cond_wait(&pool->notify, &pool->lock);
+    if (pool->stats) {
+        uint64_t now = tp_now();
+        for (i = 0; i < n; i++) {
+            tasks[i]->enq = now;
         }
+        i = 0;
 
-        if ((pool->shutdown == tpsdown_now) ||
-                ((pool->shutdown == tpsdown_soft) &&
-                        h_empty(pool->tasks))) {
-            break;
+        size_t hwm = atomic_load_explicit(&pool->depth_hwm, memory_order_relaxed);
+        while (depth > hwm && !atomic_compare_exchange_weak(&pool->depth_hwm, &hwm, depth)) {
         }
+    }
 
-        // get the task from the queue
-        task = (tp_task *) h_pop(pool->tasks);
+    if (pool->sched == tpsched_steal && self != null && self->pool == pool) {
+        // submitted from one of our workers, keep them local
+        while (i < n && dq_push(&self->dq, tasks[i])) {
+            i++;
+        }
+    } else {
+        i = q_push_many(&pool->qs[tp_home(pool)], tasks, n);
+    }
 
-        // release the lock on the queue
-        pthread_mutex_unlock(&pool->lock);
+    if (i < n) {
+        tp_taken(pool, n - i);
+    }
+    if (i == 0) {
+        return err;
+    }
 
-        if (task->fut == null) {
-            // run the task without waiting for the future
-            task->func(task->arg);
-        } else {
-            // get the lock on the future so we can run the task
-            pthread_mutex_lock(&task->fut->lock);
-            task->fut->ret = task->func(task->arg);
-            task->fut->done = true;
+    tp_wake(pool, i);
+    tp_grow(pool);
+    return (int) i;
+}
+
+static bool tp_spawn(threadpool *pool) {
+    size_t i;
+    for (i = 0; i < pool->max_ts; i++) {
+        tp_worker *w = &pool->ws[i];
+        if (w->state == tpw_live) {
+            continue;
+        }
 
-            // let the calling thread know the
-            pthread_cond_broadcast(&task->fut->notify);
-            pthread_mutex_unlock(&task->fut->lock);
+        // reap the thread that retired from this slot before reusing it
+        if (w->state == tpw_retired) {
+            pthread_join(w->t, null);
+            w->state = tpw_free;
         }
 
-        // this task is complete, free allocated memory
-        free(task);
+        // pin the worker when it has a cpu, falling back to an unpinned thread if the cpu is refused
+        bool created = false;
+        pthread_attr_t attr;
+        if (w->cpu >= 0 && pthread_attr_init(&attr) == 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(w->cpu, &set);
+            created = pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &set) == 0 &&
+                    pthread_create(&w->t, &attr, tp_thread, (void *) w) == 0;
+            pthread_attr_destroy(&attr);
+        }
+        if (!created && pthread_create(&w->t, null, tp_thread, (void *) w) != 0) {
+            return false;
+        }
+        w->state = tpw_live;
+        pool->num_ts++;
+        pool->started++;
+        pool->grown++;
+        return true;
     }
 
-    pool->started--;
+    return false;
+}
+
+static void tp_grow(threadpool *pool) {
+    size_t n = pool->num_ts;
+    if (n >= pool->max_ts || atomic_load(&pool->pending) <= pool->grow_backlog * n) {
+        return;
+    }
 
+    if (pthread_mutex_lock(&pool->lock) != 0) {
+        return;
+    }
+    n = pool->num_ts;
+    if (!pool->shutdown && n < pool->max_ts &&
+            atomic_load(&pool->pending) > pool->grow_backlog * n) {
+        tp_spawn(pool);
+    }
     pthread_mutex_unlock(&pool->lock);
-    pthread_exit(null);
 }
 
-void *tp_await(threadpool *pool, tp_future *fut) {
-    void *ret = null;
-    pthread_mutex_lock(&fut->lock);
-    while (!fut->done && !pool->shutdown) {
-        pthread_cond_wait(&fut->notify, &fut->lock);
+static void tp_wake(threadpool *pool, size_t n) {
+    size_t parked = atomic_load(&pool->parked);
+    if (parked == 0) {
+        return;
     }
 
-    if (fut->done) {
-        ret = fut->ret;
+    if (pthread_mutex_lock(&pool->lock) != 0) {
+        return;
     }
 
-    tp_future_free(fut);
-
-    return ret;
+    // send notification that the queue has work, one worker per new task
+    if (n >= parked) {
+        pthread_cond_broadcast(&pool->notify);
+    } else {
+        while (n-- > 0) {
+            pthread_cond_signal(&pool->notify);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
 }
 
-bool tp_taskcomp(void const *lhs, void const *rhs) {
-    return ((tp_task *) lhs)->pty > ((tp_task *) rhs)->pty;
-}
+int tp_dest(threadpool *pool, int flags) {
+    int err = 0;
+    size_t i;
 
-void *tp_future_free(void *fut) {
-    tp_future *f = (tp_future *) fut;
-    pthread_mutex_destroy(&f->lock);
-    pthread_cond_destroy(&f->notify);
-    free(f);
+    if (pool == null) {
+        return tp_invalid;
+    }
+
+    if (pthread_mutex_lock(&pool->lock) != 0) {
+        return tp_lockfail;
+    }
+
+    // check that we're not shutting down already
+    if (!pool->shutdown) {
+        // tpexit_graceful and tpsdown_soft both let the queued tasks run first
+        pool->shutdown = (flags & (tpexit_graceful | tpsdown_soft)) ? tpsdown_soft : tpsdown_now;
+
+        // wakeup worker threads and throttled submitters
+        if (pthread_cond_broadcast(&pool->notify) != 0 ||
+                pthread_cond_broadcast(&pool->space) != 0 ||
+                pthread_mutex_unlock(&pool->lock) != 0) {
+            err = tp_lockfail;
+        }
+
+        // stop the timer thread, no timer can be armed once shutdown is set
+        pthread_mutex_lock(&pool->wheel.lock);
+        bool timers = pool->wheel.started;
+        pthread_cond_broadcast(&pool->wheel.notify);
+        pthread_mutex_unlock(&pool->wheel.lock);
+        if (timers && pthread_join(pool->wheel.t, null) != 0) {
+            err = tp_threadfail;
+        }
+
+        // recall worker threads, no slot changes state once shutdown is set
+        for (i = 0; i < pool->num_ws; i++) {
+            if (pool->ws[i].state != tpw_free && pthread_join(pool->ws[i].t, null) != 0) {
+                err = tp_threadfail;
+            }
+        }
+    } else {
+        pthread_mutex_unlock(&pool->lock);
+        err = tp_shutdown;
+    }
+
+    // don't free if we hit an error
+    if (!err) {
+        tp_free(pool);
+    }
+    return err;
+}
+
+// recycle a task that won't run, cancelling its future so awaiting threads can return
+static void tp_task_drop(threadpool *pool, tp_worker *w, tp_task *task) {
+    if (task->fut != null) {
+        tp_resolve(task->fut, null, true);
+    }
+    if (task->token != null) {
+        tp_token_free(task->token);
+    }
+    // a tp_parallel_for helper holds a reference on its range that nobody else will drop
+    if (task->func == tp_range_run) {
+        tp_range_unref((tp_range *) task->arg);
+    }
+    slab_put(pool->slab, w, false, task);
+}
+
+int tp_free(threadpool *pool) {
+    if (pool == null || pool->started > 0) {
+        return -1;
+    }
+
+    // release threadpool if it has been created
+    if (pool->ws) {
+        size_t i;
+        for (i = 0; i < pool->num_ws; i++) {
+            tp_task *task;
+            while ((task = dq_take(&pool->ws[i].dq)) != null) {
+                tp_task_drop(pool, null, task);
+            }
+            dq_free(&pool->ws[i].dq);
+        }
+        free(pool->ws);
+    }
+
+    // free the task queues if they have been initialized
+    if (pool->qs != null) {
+        size_t i;
+        for (i = 0; i < pool->num_qs; i++) {
+            tp_queue *q = &pool->qs[i];
+            tp_task *task;
+            while ((task = q_pop(q)) != null) {
+                tp_task_drop(pool, null, task);
+            }
+            if (q->tasks != null) {
+                kh_free(q->tasks);
+            }
+            pthread_mutex_destroy(&q->lock);
+        }
+        free(pool->qs);
+    }
+    free(pool->cpu_node);
+    tw_free(&pool->wheel);
+
+    // fibers suspended when the pool was shut down immediately are released along with the idle ones
+    tp_fiber *f, *next;
+    for (f = pool->fiber_all; f != null; f = next) {
+        next = f->all;
+        munmap(f->stack, pool->fiber_stack);
+        free(f);
+    }
+    pthread_mutex_destroy(&pool->fiber_lock);
+
+    // futures still held by callers keep the slab alive
+    if (pool->slab != null) {
+        slab_unref(pool->slab);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->notify);
+    pthread_cond_destroy(&pool->space);
+    free(pool);
+    return 0;
+}
+
+static tp_task *tp_next(threadpool *pool, tp_worker *w) {
+    tp_task *task = null;
+    size_t i;
+
+    if (pool->sched == tpsched_steal) {
+        task = dq_take(&w->dq);
+
+        // keep priorities approximately: prefer the shared queue when it holds something more urgent
+        if (task != null && pool->qs[w->node].len > 0 && pool->qs[w->node].top_pty > task->pty) {
+            dq_push(&w->dq, task);
+            task = null;
+        } else if (task != null) {
+            tp_taken(pool, 1);
+            return task;
+        }
+    }
+
+    // our own node's queue first, then the other nodes
+    for (i = 0; i < pool->num_qs; i++) {
+        if ((task = q_pop(&pool->qs[(w->node + i) % pool->num_qs])) != null) {
+            tp_taken(pool, 1);
+            return task;
+        }
+    }
+
+    if (pool->sched == tpsched_steal) {
+        // the local deque may have been bounced above, take it back
+        if ((task = dq_take(&w->dq)) != null) {
+            tp_taken(pool, 1);
+            return task;
+        }
+
+        // steal from the other workers starting at a random victim
+        w->rng ^= w->rng << 13;
+        w->rng ^= w->rng >> 17;
+        w->rng ^= w->rng << 5;
+        size_t start = w->rng % pool->num_ws;
+        for (i = 0; i < pool->num_ws; i++) {
+            tp_worker *v = &pool->ws[(start + i) % pool->num_ws];
+            if (v != w && (task = dq_steal(&v->dq)) != null) {
+                if (pool->stats) {
+                    tp_bump(&w->st.steals, 1);
+                }
+                tp_taken(pool, 1);
+                return task;
+            }
+        }
+    }
+
+    return null;
+}
+
+static void tp_run(threadpool *pool, tp_worker *w, tp_task *task) {
+    tp_fiber *f;
+
+    // pick a suspended fiber back up where it left off
+    if (task->func == tp_resume) {
+        f = (tp_fiber *) task->arg;
+        slab_put(pool->slab, w, false, task);
+        atomic_fetch_sub(&pool->suspended, 1);
+        tp_switch(pool, w, f);
+        return;
+    }
+
+    // skip tasks that were cancelled or went stale while queued
+    if (task->token != null && atomic_load_explicit(&task->token->cancelled, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&pool->cancelled, 1, memory_order_relaxed);
+        tp_task_drop(pool, w, task);
+        return;
+    }
+    if (task->deadline != 0 && tp_now() > task->deadline) {
+        atomic_fetch_add_explicit(&pool->expired, 1, memory_order_relaxed);
+        tp_task_drop(pool, w, task);
+        return;
+    }
+
+    // without a fiber to spare the task simply runs on the worker's stack
+    if (pool->fiber_stack > 0 && (f = fiber_get(pool, w)) != null) {
+        f->task = task;
+        tp_switch(pool, w, f);
+        return;
+    }
+
+    tp_exec(pool, w, task);
+}
+
+static void tp_exec(threadpool *pool, tp_worker *w, tp_task *task) {
+    uint64_t start = 0;
+    if (pool->stats) {
+        start = tp_now();
+        tp_bump(&w->st.wait_hist[tp_hist_bucket(start - task->enq)], 1);
+    }
+
+    if (task->fut == null) {
+        // run the task without waiting for the future
+        task->func(task->arg);
+    } else {
+        // publish the result and let the calling thread know
+        tp_resolve(task->fut, task->func(task->arg), false);
+    }
+
+    // a task that suspended may have finished on another worker
+    w = tp_current();
+
+    if (pool->stats) {
+        uint64_t took = tp_now() - start;
+        tp_bump(&w->st.tasks_run, 1);
+        tp_bump(&w->st.run_hist[tp_hist_bucket(took)], 1);
+        atomic_store_explicit(&w->st.busy_ns,
+                atomic_load_explicit(&w->st.busy_ns, memory_order_relaxed) + took, memory_order_relaxed);
+    }
+
+    // this task is complete, hand it back to the slab
+    if (task->token != null) {
+        tp_token_free(task->token);
+    }
+    slab_put(pool->slab, w, false, task);
+}
+
+static void *tp_thread(void *arg) {
+    tp_worker *w = (tp_worker *) arg;
+    threadpool *pool = w->pool;
+    tp_task *task;
+
+    tp_self = w;
+    atomic_store_explicit(&w->st.start_ns, tp_now(), memory_order_relaxed);
+
+    // set after a wakeup so the next empty-handed search counts as spurious
+    bool woke = false;
+
+    while (true) {
+        // drop whatever is left when shutting down immediately
+        if (pool->shutdown == tpsdown_now) {
+            pthread_mutex_lock(&pool->lock);
+            break;
+        }
+
+        if ((task = tp_next(pool, w)) != null) {
+            woke = false;
+            tp_run(pool, w, task);
+            continue;
+        }
+
+        if (woke && pool->stats) {
+            tp_bump(&w->st.spurious, 1);
+        }
+        woke = false;
+
+        // a short wait for the next task is cheaper than a futex round trip
+        if (pool->spin_ns > 0 && tp_spin(pool)) {
+            continue;
+        }
+
+        // nothing to run, park until a submitter signals
+        pthread_mutex_lock(&pool->lock);
+        atomic_fetch_add(&pool->parked, 1);
+
+        // elastic pools retire workers that stay idle for idle_ms
+        bool elastic = pool->max_ts > pool->min_ts;
+        struct timespec until;
+        if (elastic) {
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_sec += pool->idle_ms / 1000;
+            until.tv_nsec += (long) (pool->idle_ms % 1000) * 1000000;
+            if (until.tv_nsec >= 1000000000) {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000;
+            }
+        }
+
+        // wait on condition variable, check for spurious wakeups
+        // we own the lock when returning from pthread_cond_wait
+        bool retire = false, waited = false;
+        while (atomic_load(&pool->pending) == 0 && !pool->shutdown) {
+            waited = true;
+            if (!elastic) {
+                pthread_cond_wait(&pool->notify, &pool->lock);
+            } else if (pthread_cond_timedwait(&pool->notify, &pool->lock, &until) == ETIMEDOUT) {
+                retire = atomic_load(&pool->pending) == 0 && !pool->shutdown &&
+                        pool->num_ts > pool->min_ts;
+                break;
+            }
+        }
+        atomic_fetch_sub(&pool->parked, 1);
+
+        // only a real sleep counts as a wakeup
+        if (waited && pool->stats) {
+            tp_bump(&w->st.wakeups, 1);
+        }
+        woke = waited;
+
+        if (retire) {
+            // our deque is empty since tp_next came back empty-handed, the slot is reaped by tp_spawn or tp_dest
+            pool->num_ts--;
+            pool->shrunk++;
+            w->state = tpw_retired;
+            break;
+        }
+
+        if ((pool->shutdown == tpsdown_now) ||
+                ((pool->shutdown == tpsdown_soft) &&
+                        atomic_load(&pool->pending) == 0 && atomic_load(&pool->suspended) == 0)) {
+            break;
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    pool->started--;
+    tp_self = null;
+
+    // fold this thread's lifetime into the slot so utilization survives retirement
+    atomic_store_explicit(&w->st.alive_ns, atomic_load_explicit(&w->st.alive_ns, memory_order_relaxed) +
+            tp_now() - atomic_load_explicit(&w->st.start_ns, memory_order_relaxed), memory_order_relaxed);
+    atomic_store_explicit(&w->st.start_ns, 0, memory_order_relaxed);
+
+    pthread_mutex_unlock(&pool->lock);
+    pthread_exit(null);
+}
+
+// kept out of line so every call looks the thread local up again, a caller inlining it may reuse the
+// address it computed before a fiber switch even though the fiber has since moved to another thread
+static __attribute__((noinline)) tp_worker *tp_current(void) {
+    return tp_self;
+}
+
+static void *tp_resume(void *arg) {
+    return arg;
+}
+
+static void tp_switch(threadpool *pool, tp_worker *w, tp_fiber *f) {
+    w->fiber = f;
+    f->w = w;
+    swapcontext(&w->sched, &f->ctx);
+    w->fiber = null;
+
+    // the fiber is off its stack now, so it is safe to let another worker resume it
+    if (f->wait != null) {
+        tp_future *fut = f->wait;
+        f->wait = null;
+        atomic_fetch_add(&pool->suspended, 1);
+        tp_future_then(fut, &f->c);
+    } else if (f->task == null) {
+        fiber_put(pool, w, f);
+    }
+}
+
+static void fiber_main(void) {
+    // the fiber starts on the worker that switched to it first
+    tp_fiber *f = tp_current()->fiber;
+
+    // the worker can change across any switch inside the task, so take it from the fiber every time
+    while (true) {
+        tp_exec(f->pool, f->w, f->task);
+        f->task = null;
+        swapcontext(&f->ctx, &f->w->sched);
+    }
+}
+
+static void fiber_fire(tp_cont *c, void *ret, bool cancelled) {
+    tp_fiber *f = (tp_fiber *) c;
+    f->ret = ret;
+    f->cancelled = cancelled;
+
+    // the pool still owns the fiber while it shuts down softly, so the resume bypasses the shutdown check
+    tp_task *task = f->resume;
+    f->resume = null;
+    task->func = tp_resume;
+    task->arg = f;
+    task->fut = null;
+    task->token = null;
+    task->deadline = 0;
+    tp_enqueue(f->pool, &task, 1, false);
+}
+
+static tp_fiber *fiber_get(threadpool *pool, tp_worker *w) {
+    tp_fiber *f;
+
+    if ((f = w->fibers) != null) {
+        w->fibers = f->next;
+        w->num_fibers--;
+        return f;
+    }
+
+    pthread_mutex_lock(&pool->fiber_lock);
+    if ((f = pool->fibers) != null) {
+        pool->fibers = f->next;
+    }
+    pthread_mutex_unlock(&pool->fiber_lock);
+    if (f != null) {
+        return f;
+    }
+
+    // map a new stack with a guard page at the bottom
+    if ((f = malloc(sizeof(tp_fiber))) == null) {
+        return null;
+    }
+    f->stack = mmap(null, pool->fiber_stack, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (f->stack == MAP_FAILED) {
+        free(f);
+        return null;
+    }
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    mprotect(f->stack, page, PROT_NONE);
+
+    if (!fiber_ctx(pool, f, page)) {
+        munmap(f->stack, pool->fiber_stack);
+        free(f);
+        return null;
+    }
+
+    f->c.fire = fiber_fire;
+    f->pool = pool;
+    f->task = null;
+    f->wait = null;
+    f->resume = null;
+
+    pthread_mutex_lock(&pool->fiber_lock);
+    f->all = pool->fiber_all;
+    pool->fiber_all = f;
+    pthread_mutex_unlock(&pool->fiber_lock);
+
+    return f;
+}
+
+// set up the fiber's context to start in fiber_main on its own stack
+// kept out of line so no caller locals are live across getcontext, which the compiler treats as returning twice
+static __attribute__((noinline)) bool fiber_ctx(threadpool *pool, tp_fiber *f, size_t page) {
+    if (getcontext(&f->ctx) != 0) {
+        return false;
+    }
+    f->ctx.uc_stack.ss_sp = (char *) f->stack + page;
+    f->ctx.uc_stack.ss_size = pool->fiber_stack - page;
+    f->ctx.uc_link = null;
+    makecontext(&f->ctx, fiber_main, 0);
+
+    return true;
+}
+
+static void fiber_put(threadpool *pool, tp_worker *w, tp_fiber *f) {
+    if (w->num_fibers < TP_FIBER_CACHE) {
+        f->next = w->fibers;
+        w->fibers = f;
+        w->num_fibers++;
+        return;
+    }
+
+    pthread_mutex_lock(&pool->fiber_lock);
+    f->next = pool->fibers;
+    pool->fibers = f;
+    pthread_mutex_unlock(&pool->fiber_lock);
+}
+
+void *tp_await(threadpool *pool, tp_future *fut) {
+    void *ret = null;
+    tp_await_status(pool, fut, &ret);
+
+    return ret;
+}
+
+int tp_await_status(threadpool *pool, tp_future *fut, void **ret) {
+    if (pool == null || fut == null || ret == null) {
+        return tp_invalid;
+    }
+
+    // on a fiber, suspend instead of blocking the worker unless the future is already there
+    tp_worker *w = tp_current();
+    if (w != null && w->fiber != null) {
+        tp_fiber *f = w->fiber;
+        pthread_mutex_lock(&fut->lock);
+        bool done = fut->done;
+        pthread_mutex_unlock(&fut->lock);
+
+        // the resume task is taken up front so the continuation can't fail
+        if (!done && (f->resume = slab_get(w->pool->slab, w, false)) != null) {
+            f->resume->pty = f->task->pty;
+            f->wait = fut;
+            swapcontext(&f->ctx, &w->sched);
+
+            // resumed, maybe on another worker, so 'w' is stale and f->w names the current one
+            // the continuation has consumed the future
+            *ret = f->ret;
+            return f->cancelled ? tp_cancelled : 0;
+        }
+    }
+
+    pthread_mutex_lock(&fut->lock);
+    while (!fut->done) {
+        pthread_cond_wait(&fut->notify, &fut->lock);
+    }
+    *ret = fut->ret;
+    bool cancelled = fut->cancelled;
+    pthread_mutex_unlock(&fut->lock);
+
+    tp_future_free(fut);
+
+    return cancelled ? tp_cancelled : 0;
+}
+
+tp_token *tp_token_init(void) {
+    tp_token *tok;
+    if ((tok = malloc(sizeof(tp_token))) == null) {
+        return null;
+    }
+    atomic_init(&tok->cancelled, false);
+    atomic_init(&tok->refs, 1);
+
+    return tok;
+}
+
+void tp_token_cancel(tp_token *tok) {
+    if (tok != null) {
+        atomic_store(&tok->cancelled, true);
+    }
+}
+
+bool tp_token_cancelled(tp_token const *tok) {
+    return tok != null && atomic_load(&tok->cancelled);
+}
+
+void tp_token_free(tp_token *tok) {
+    if (tok != null && atomic_fetch_sub(&tok->refs, 1) == 1) {
+        free(tok);
+    }
+}
+
+static tp_future *tp_future_new(threadpool *pool, tp_worker *w) {
+    tp_future *fut;
+
+    // recycled futures come with their lock and condition already initialized
+    if ((fut = slab_get(pool->slab, w, true)) == null) {
+        return null;
+    }
+    atomic_fetch_add(&pool->slab->refs, 1);
+    fut->slab = pool->slab;
+    fut->done = false;
+    fut->cancelled = false;
+    fut->ret = null;
+    fut->cont = null;
+
+    return fut;
+}
+
+static void tp_resolve(tp_future *fut, void *ret, bool cancelled) {
+    pthread_mutex_lock(&fut->lock);
+    fut->ret = ret;
+    fut->done = true;
+    fut->cancelled = cancelled;
+    tp_cont *c = fut->cont;
+    pthread_cond_broadcast(&fut->notify);
+    pthread_mutex_unlock(&fut->lock);
+
+    // nobody awaits a future with a continuation, release it once the continuation has the result
+    if (c != null) {
+        c->fire(c, ret, cancelled);
+        tp_future_free(fut);
+    }
+}
+
+static void tp_future_then(tp_future *fut, tp_cont *c) {
+    pthread_mutex_lock(&fut->lock);
+    if (!fut->done) {
+        fut->cont = c;
+        pthread_mutex_unlock(&fut->lock);
+        return;
+    }
+    void *ret = fut->ret;
+    bool cancelled = fut->cancelled;
+    pthread_mutex_unlock(&fut->lock);
+
+    c->fire(c, ret, cancelled);
+    tp_future_free(fut);
+}
+
+static void tp_then_fire(tp_cont *c, void *ret, bool cancelled) {
+    tp_then_cont *t = (tp_then_cont *) c;
+    threadpool *pool = t->pool;
+    tp_worker *w = slab_worker(pool->slab);
+    tp_task *task = null;
+
+    // cancellation propagates down the chain, as does a pool that is shutting down
+    if (!cancelled && (task = slab_get(pool->slab, w, false)) != null) {
+        task->func = t->func;
+        task->arg = ret;
+        task->pty = t->pty;
+        task->fut = t->out;
+        task->token = null;
+        task->deadline = 0;
+        if (tp_submit(pool, task, TP_WAIT_FOREVER) != 0) {
+            slab_put(pool->slab, w, false, task);
+            task = null;
+        }
+    }
+    if (task == null) {
+        tp_resolve(t->out, null, true);
+    }
+
+    free(t);
+}
+
+tp_future *tp_then(threadpool *pool, tp_future *fut, void *(*func)(void *), int priority) {
+    if (pool == null || fut == null || func == null) {
+        return null;
+    }
+
+    tp_then_cont *t;
+    if ((t = malloc(sizeof(tp_then_cont))) == null) {
+        return null;
+    }
+    if ((t->out = tp_future_new(pool, slab_worker(pool->slab))) == null) {
+        free(t);
+        return null;
+    }
+    t->c.fire = tp_then_fire;
+    t->pool = pool;
+    t->func = func;
+    t->pty = priority;
+
+    tp_future *out = t->out;
+    tp_future_then(fut, &t->c);
+
+    return out;
+}
+
+static void tp_all_fire(tp_cont *c, void *ret, bool cancelled) {
+    tp_join_cont *jc = (tp_join_cont *) c;
+    tp_join *j = jc->j;
+
+    j->rets[jc->i] = ret;
+    if (cancelled) {
+        atomic_store(&j->fired, true);
+    }
+    if (atomic_fetch_sub(&j->left, 1) == 1) {
+        // the results array now belongs to whoever awaits the combined future, unless an input was cancelled
+        if (atomic_load(&j->fired)) {
+            free(j->rets);
+            tp_resolve(j->out, null, true);
+        } else {
+            tp_resolve(j->out, j->rets, false);
+        }
+        free(j);
+    }
+}
+
+static void tp_any_fire(tp_cont *c, void *ret, bool cancelled) {
+    tp_join *j = ((tp_join_cont *) c)->j;
+    bool fired = false;
+
+    // the first input that ran wins, the combined future is only cancelled if all of them were
+    if (!cancelled && atomic_compare_exchange_strong(&j->fired, &fired, true)) {
+        tp_resolve(j->out, ret, false);
+    }
+    if (atomic_fetch_sub(&j->left, 1) == 1) {
+        if (!atomic_load(&j->fired)) {
+            tp_resolve(j->out, null, true);
+        }
+        free(j->rets);
+        free(j);
+    }
+}
+
+// build the shared state for a combinator over 'n' futures
+static tp_join *tp_join_new(threadpool *pool, size_t n, bool all) {
+    tp_join *j;
+    if ((j = malloc(sizeof(tp_join) + n * sizeof(tp_join_cont))) == null) {
+        return null;
+    }
+
+    j->rets = null;
+    if (all && (j->rets = malloc((n == 0 ? 1 : n) * sizeof(void *))) == null) {
+        free(j);
+        return null;
+    }
+    if ((j->out = tp_future_new(pool, slab_worker(pool->slab))) == null) {
+        free(j->rets);
+        free(j);
+        return null;
+    }
+    atomic_init(&j->left, n);
+    atomic_init(&j->fired, false);
+
+    size_t i;
+    for (i = 0; i < n; i++) {
+        j->cs[i].c.fire = all ? tp_all_fire : tp_any_fire;
+        j->cs[i].j = j;
+        j->cs[i].i = i;
+    }
+
+    return j;
+}
+
+// whether any of the 'n' futures is missing
+static bool tp_futs_null(tp_future **futs, size_t n) {
+    size_t i;
+    for (i = 0; i < n; i++) {
+        if (futs[i] == null) {
+            return true;
+        }
+    }
+    return false;
+}
+
+tp_future *tp_when_all(threadpool *pool, tp_future **futs, size_t n) {
+    if (pool == null || (futs == null && n > 0) || tp_futs_null(futs, n)) {
+        return null;
+    }
+
+    tp_join *j;
+    if ((j = tp_join_new(pool, n, true)) == null) {
+        return null;
+    }
+
+    tp_future *out = j->out;
+    if (n == 0) {
+        tp_resolve(out, j->rets, false);
+        free(j);
+        return out;
+    }
+
+    size_t i;
+    for (i = 0; i < n; i++) {
+        tp_future_then(futs[i], &j->cs[i].c);
+    }
+
+    return out;
+}
+
+tp_future *tp_when_any(threadpool *pool, tp_future **futs, size_t n) {
+    if (pool == null || futs == null || n == 0 || tp_futs_null(futs, n)) {
+        return null;
+    }
+
+    tp_join *j;
+    if ((j = tp_join_new(pool, n, false)) == null) {
+        return null;
+    }
+
+    tp_future *out = j->out;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        tp_future_then(futs[i], &j->cs[i].c);
+    }
+
+    return out;
+}
+
+size_t tp_grain(threadpool *pool, size_t n) {
+    size_t split = (pool == null ? 1 : pool->num_ts) * TP_GRAIN_SPLIT;
+    return n / split + (n % split != 0);
+}
+
+// claim and run chunks until none are left, then report how many this thread ran
+static void *tp_range_run(void *arg) {
+    tp_range *r = (tp_range *) arg;
+    size_t c, ran = 0;
+
+    while ((c = atomic_fetch_add(&r->next, 1)) < r->chunks) {
+        size_t lo = c * r->grain;
+        size_t hi = lo + r->grain < r->n ? lo + r->grain : r->n;
+        r->body(r->ctx, lo, hi);
+        ran++;
+    }
+
+    if (ran > 0) {
+        pthread_mutex_lock(&r->lock);
+        r->done += ran;
+        if (r->done == r->chunks) {
+            pthread_cond_broadcast(&r->notify);
+        }
+        pthread_mutex_unlock(&r->lock);
+    }
+    tp_range_unref(r);
+
+    return null;
+}
+
+// the caller and every queued helper hold a reference, the last one out frees the range
+static void tp_range_unref(tp_range *r) {
+    if (atomic_fetch_sub(&r->refs, 1) == 1) {
+        pthread_mutex_destroy(&r->lock);
+        pthread_cond_destroy(&r->notify);
+        free(r);
+    }
+}
+
+int tp_parallel_for(threadpool *pool, size_t n, size_t grain,
+        void_ptr (*body)(void_ptr, size_t, size_t), void_ptr ctx) {
+    if (pool == null || body == null) {
+        return tp_invalid;
+    }
+    if (n == 0) {
+        return 0;
+    }
+
+    tp_range *r;
+    if ((r = malloc(sizeof(tp_range))) == null) {
+        return tp_lockfail;
+    }
+    if (pthread_mutex_init(&r->lock, null) != 0) {
+        free(r);
+        return tp_lockfail;
+    }
+    if (pthread_cond_init(&r->notify, null) != 0) {
+        pthread_mutex_destroy(&r->lock);
+        free(r);
+        return tp_lockfail;
+    }
+
+    r->n = n;
+    r->grain = grain == 0 ? tp_grain(pool, n) : grain;
+    r->chunks = n / r->grain + (n % r->grain != 0);
+    r->done = 0;
+    r->body = body;
+    r->ctx = ctx;
+    atomic_init(&r->next, 0);
+
+    // one helper per worker at most, the caller runs chunks as well so a busy pool can't stall it
+    size_t i, helpers = r->chunks - 1 < pool->num_ts ? r->chunks - 1 : pool->num_ts;
+    atomic_init(&r->refs, helpers + 2);
+
+    if (helpers > 0) {
+        tp_job *jobs;
+        int queued = 0;
+        if ((jobs = malloc(helpers * sizeof(tp_job))) != null) {
+            for (i = 0; i < helpers; i++) {
+                jobs[i].func = tp_range_run;
+                jobs[i].arg = r;
+                jobs[i].priority = 0;
+                jobs[i].token = null;
+                jobs[i].deadline_ms = 0;
+            }
+            queued = tp_add_batch(pool, jobs, helpers);
+            free(jobs);
+        }
+
+        // drop the references of helpers that never made it into the queue
+        if (queued < (int) helpers) {
+            atomic_fetch_sub(&r->refs, helpers - (queued < 0 ? 0 : (size_t) queued));
+        }
+    }
+
+    // keep our own reference until every chunk is done
+    tp_range_run(r);
+
+    pthread_mutex_lock(&r->lock);
+    while (r->done < r->chunks) {
+        pthread_cond_wait(&r->notify, &r->lock);
+    }
+    pthread_mutex_unlock(&r->lock);
+    tp_range_unref(r);
+
+    return 0;
+}
+
+tp_timer tp_add_after(threadpool *pool, uint64_t delay_ms, void *(*func)(void *), void *arg, int priority) {
+    return tw_arm(pool, delay_ms, 0, func, arg, priority);
+}
+
+tp_timer tp_add_every(threadpool *pool, uint64_t period_ms, void *(*func)(void *), void *arg, int priority) {
+    if (period_ms == 0) {
+        return 0;
+    }
+
+    return tw_arm(pool, period_ms, period_ms, func, arg, priority);
+}
+
+int tp_cancel(threadpool *pool, tp_timer t) {
+    if (pool == null) {
+        return tp_invalid;
+    }
+
+    // the low half is the entry index plus one, the high half its generation
+    tp_wheel *wh = &pool->wheel;
+    int err = tp_invalid;
+    size_t i = (size_t) (t & 0xffffffffu) - 1;
+    pthread_mutex_lock(&wh->lock);
+    if (t != 0 && i < wh->num_es && wh->es[i].gen == (uint32_t) (t >> 32) && wh->es[i].slot >= 0) {
+        tw_unlink(wh, (int32_t) i);
+        wh->es[i].gen++;
+        wh->es[i].slot = -1;
+        wh->es[i].next = wh->free;
+        wh->free = (int32_t) i;
+        wh->armed--;
+        err = 0;
+    }
+    pthread_mutex_unlock(&wh->lock);
+
+    return err;
+}
+
+static tp_timer tw_arm(threadpool *pool, uint64_t delay_ms, uint64_t period_ms, void *(*func)(void *),
+        void *arg, int priority) {
+    if (pool == null || func == null) {
+        return 0;
+    }
+
+    tp_wheel *wh = &pool->wheel;
+    pthread_mutex_lock(&wh->lock);
+    if (pool->shutdown) {
+        pthread_mutex_unlock(&wh->lock);
+        return 0;
+    }
+
+    // the timer thread is only paid for by pools that use timers
+    if (!wh->started) {
+        if (pthread_create(&wh->t, null, tp_timer_thread, (void *) pool) != 0) {
+            pthread_mutex_unlock(&wh->lock);
+            return 0;
+        }
+        wh->started = true;
+    }
+
+    // take a free entry, growing the table when there is none
+    int32_t i = wh->free;
+    if (i < 0) {
+        if (wh->num_es == wh->max_es) {
+            size_t m = wh->max_es == 0 ? 64 : wh->max_es * 2;
+            tp_tentry *es;
+            if (m > INT32_MAX || (es = realloc(wh->es, m * sizeof(tp_tentry))) == null) {
+                pthread_mutex_unlock(&wh->lock);
+                return 0;
+            }
+            wh->es = es;
+            wh->max_es = m;
+        }
+        i = (int32_t) wh->num_es++;
+        wh->es[i].gen = 1;
+    } else {
+        wh->free = wh->es[i].next;
+    }
+
+    // round up so the timer never fires early, and never into a tick that has been processed
+    tp_tentry *e = &wh->es[i];
+    uint64_t at = (tp_now() - wh->base + delay_ms * 1000000 + TP_TICK_NS - 1) / TP_TICK_NS;
+    e->func = func;
+    e->arg = arg;
+    e->pty = priority;
+    e->period = period_ms * 1000000 / TP_TICK_NS;
+    e->expiry = at > wh->cur ? at : wh->cur + 1;
+    tw_link(wh, i);
+
+    // wake the timer thread if it would sleep past the new expiry
+    wh->armed++;
+    if (e->expiry < wh->wake) {
+        pthread_cond_signal(&wh->notify);
+    }
+    tp_timer t = ((uint64_t) e->gen << 32) | (uint64_t) (i + 1);
+    pthread_mutex_unlock(&wh->lock);
+
+    return t;
+}
+
+static bool tw_init(tp_wheel *wh) {
+    pthread_condattr_t attr;
+    size_t i;
+
+    wh->started = false;
+    wh->es = null;
+    wh->num_es = wh->max_es = 0;
+    wh->free = -1;
+    wh->armed = 0;
+    wh->cur = 0;
+    wh->wake = UINT64_MAX;
+    wh->base = tp_now();
+    wh->due = null;
+    wh->max_due = 0;
+    for (i = 0; i < TP_WHEEL_LEVELS * TP_WHEEL_SLOTS; i++) {
+        wh->slots[i] = -1;
+    }
+
+    // deadlines are computed from the monotonic clock
+    if (pthread_condattr_init(&attr) != 0) {
+        return false;
+    }
+    bool ok = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) == 0 &&
+            pthread_cond_init(&wh->notify, &attr) == 0;
+    pthread_condattr_destroy(&attr);
+    if (!ok) {
+        return false;
+    }
+    if (pthread_mutex_init(&wh->lock, null) != 0) {
+        pthread_cond_destroy(&wh->notify);
+        return false;
+    }
+
+    return true;
+}
+
+static void tw_free(tp_wheel *wh) {
+    free(wh->es);
+    free(wh->due);
+    pthread_mutex_destroy(&wh->lock);
+    pthread_cond_destroy(&wh->notify);
+}
+
+static void tw_link(tp_wheel *wh, int32_t i) {
+    tp_tentry *e = &wh->es[i];
+    uint64_t delta = e->expiry - wh->cur;
+    uint64_t at = e->expiry;
+    size_t l;
+
+    // the level is picked by how far away the expiry is, the slot by its bits at that level
+    for (l = 0; l < TP_WHEEL_LEVELS - 1 && delta >= (uint64_t) 1 << (TP_WHEEL_BITS * (l + 1)); l++) {
+    }
+    if (delta >= (uint64_t) 1 << (TP_WHEEL_BITS * TP_WHEEL_LEVELS)) {
+        // beyond the wheel, park it at the far end and relink it when that slot cascades
+        at = wh->cur + ((uint64_t) 1 << (TP_WHEEL_BITS * TP_WHEEL_LEVELS)) - 1;
+    }
+    int32_t s = (int32_t) (l * TP_WHEEL_SLOTS + ((at >> (TP_WHEEL_BITS * l)) & (TP_WHEEL_SLOTS - 1)));
+
+    e->slot = s;
+    e->prev = -1;
+    e->next = wh->slots[s];
+    if (e->next >= 0) {
+        wh->es[e->next].prev = i;
+    }
+    wh->slots[s] = i;
+}
+
+static void tw_unlink(tp_wheel *wh, int32_t i) {
+    tp_tentry *e = &wh->es[i];
+    if (e->prev >= 0) {
+        wh->es[e->prev].next = e->next;
+    } else {
+        wh->slots[e->slot] = e->next;
+    }
+    if (e->next >= 0) {
+        wh->es[e->next].prev = e->prev;
+    }
+}
+
+static void tw_tick(threadpool *pool, tp_wheel *wh, size_t *n) {
+    size_t l, top = 0;
+    int32_t i, next;
+
+    wh->cur++;
+
+    // cascade the higher levels whose slot boundary we just crossed, outermost first
+    while (top + 1 < TP_WHEEL_LEVELS &&
+            (wh->cur & (((uint64_t) 1 << (TP_WHEEL_BITS * (top + 1))) - 1)) == 0) {
+        top++;
+    }
+    for (l = top; l > 0; l--) {
+        int32_t s = (int32_t) (l * TP_WHEEL_SLOTS + ((wh->cur >> (TP_WHEEL_BITS * l)) & (TP_WHEEL_SLOTS - 1)));
+        i = wh->slots[s];
+        wh->slots[s] = -1;
+        for (; i >= 0; i = next) {
+            next = wh->es[i].next;
+            tw_link(wh, i);
+        }
+    }
+
+    // everything left in the level 0 slot is due now
+    int32_t s = (int32_t) (wh->cur & (TP_WHEEL_SLOTS - 1));
+    i = wh->slots[s];
+    wh->slots[s] = -1;
+    for (; i >= 0; i = next) {
+        tp_tentry *e = &wh->es[i];
+        next = e->next;
+
+        if (*n == wh->max_due) {
+            size_t m = wh->max_due == 0 ? 64 : wh->max_due * 2;
+            tp_job *due;
+            if ((due = realloc(wh->due, m * sizeof(tp_job))) != null) {
+                wh->due = due;
+                wh->max_due = m;
+            }
+        }
+        tp_job job;
+        job.func = e->func;
+        job.arg = e->arg;
+        job.priority = e->pty;
+        job.token = null;
+        job.deadline_ms = 0;
+        if (*n < wh->max_due) {
+            wh->due[(*n)++] = job;
+        } else {
+            // out of memory for the batch, queue it on its own
+            // timers bypass the capacity like the batch does, a full bounded pool mustn't stall the wheel lock
+            tp_batch(pool, &job, 1, null, TP_UNBOUNDED);
+        }
+
+        if (e->period > 0) {
+            // rearm from the previous expiry so periodic timers don't drift, skipping ticks we fell behind on
+            e->expiry += e->period;
+            if (e->expiry <= wh->cur) {
+                e->expiry = wh->cur + 1;
+            }
+            tw_link(wh, i);
+        } else {
+            e->gen++;
+            e->slot = -1;
+            e->next = wh->free;
+            wh->free = i;
+            wh->armed--;
+        }
+    }
+}
+
+// first tick after 'cur' that fires a level 0 slot or cascades a higher one, UINT64_MAX if none will
+// nothing happens on the ticks before it, so the timer thread can sleep through them and skip them
+static uint64_t tw_next(tp_wheel *wh) {
+    uint64_t t, next = UINT64_MAX;
+    size_t l, d;
+
+    for (d = 1; d <= TP_WHEEL_SLOTS; d++) {
+        t = wh->cur + d;
+        if (wh->slots[t & (TP_WHEEL_SLOTS - 1)] >= 0) {
+            next = t;
+            break;
+        }
+    }
+
+    // a level l slot cascades on the first multiple of its span whose level l bits name it
+    for (l = 1; l < TP_WHEEL_LEVELS; l++) {
+        size_t shift = TP_WHEEL_BITS * l;
+        t = ((wh->cur >> shift) + 1) << shift;
+        for (d = 0; d < TP_WHEEL_SLOTS && t < next; d++, t += (uint64_t) 1 << shift) {
+            if (wh->slots[l * TP_WHEEL_SLOTS + ((t >> shift) & (TP_WHEEL_SLOTS - 1))] >= 0) {
+                next = t;
+                break;
+            }
+        }
+    }
+
+    return next;
+}
+
+static void *tp_timer_thread(void *arg) {
+    threadpool *pool = (threadpool *) arg;
+    tp_wheel *wh = &pool->wheel;
+
+    pthread_mutex_lock(&wh->lock);
+    while (!pool->shutdown) {
+        // catch up with the clock, then hand everything that fell due to the workers in one batch
+        // ticks with nothing to fire or cascade are skipped rather than walked
+        uint64_t now = (tp_now() - wh->base) / TP_TICK_NS;
+        size_t n = 0;
+        while (wh->cur < now) {
+            uint64_t next = tw_next(wh);
+            if (next > now) {
+                wh->cur = now;
+                break;
+            }
+            wh->cur = next - 1;
+            tw_tick(pool, wh, &n);
+        }
+        if (n > 0) {
+            tp_batch(pool, wh->due, n, null, TP_UNBOUNDED);
+        }
+
+        // sleep until the next tick with work, or until an earlier timer is armed
+        wh->wake = wh->armed == 0 ? UINT64_MAX : tw_next(wh);
+        if (wh->wake == UINT64_MAX) {
+            pthread_cond_wait(&wh->notify, &wh->lock);
+        } else {
+            uint64_t at = wh->base + wh->wake * TP_TICK_NS;
+            struct timespec until;
+            until.tv_sec = (time_t) (at / 1000000000u);
+            until.tv_nsec = (long) (at % 1000000000u);
+            pthread_cond_timedwait(&wh->notify, &wh->lock, &until);
+        }
+    }
+    pthread_mutex_unlock(&wh->lock);
+
+    return null;
+}
+
+static bool q_init(tp_queue *q, int kind, unsigned aging) {
+    q->tasks = null;
+    q->bits = 0;
+    q->aging = aging;
+    q->pops = 0;
+    q->seq = 0;
+    memset(q->head, 0, sizeof(q->head));
+    memset(q->tail, 0, sizeof(q->tail));
+
+    if (kind == tpq_heap && (q->tasks = kh_init(32)) == null) {
+        return false;
+    }
+    if (pthread_mutex_init(&q->lock, null) != 0) {
+        if (q->tasks != null) {
+            kh_free(q->tasks);
+        }
+        return false;
+    }
+    atomic_init(&q->len, 0);
+    atomic_init(&q->top_pty, INT_MIN);
+
+    return true;
+}
+
+// bucket of a priority, clamped to the supported range
+static size_t q_bucket(int pty) {
+    return pty < 0 ? 0 : pty >= TP_BUCKETS ? TP_BUCKETS - 1 : (size_t) pty;
+}
+
+// heap key of a priority, higher priorities get smaller keys and the sequence number breaks ties
+// the sequence wraps after 2^32 pushes, which only reorders tasks of equal priority
+static uint64_t q_key(tp_queue *q, int pty) {
+    return (uint64_t) ((int64_t) INT_MAX - pty) << 32 | q->seq++;
+}
+
+// priority a heap key was made from
+static int q_key_pty(uint64_t key) {
+    return (int) ((int64_t) INT_MAX - (int64_t) (key >> 32));
+}
+
+static size_t q_push_many(tp_queue *q, tp_task **tasks, size_t n) {
+    size_t i = 0;
+
+    // wait for lock on the queue, quit if lock fails
+    if (pthread_mutex_lock(&q->lock) != 0) {
+        return 0;
+    }
+    if (q->tasks == null) {
+        // append to the tail of each bucket, this can't fail
+        for (i = 0; i < n; i++) {
+            size_t b = q_bucket(tasks[i]->pty);
+            tasks[i]->next = null;
+            if (q->tail[b] == null) {
+                q->head[b] = tasks[i];
+            } else {
+                q->tail[b]->next = tasks[i];
+            }
+            q->tail[b] = tasks[i];
+            q->bits |= 1u << b;
+        }
+        if (n > 0) {
+            q->top_pty = 31 - __builtin_clz(q->bits);
+        }
+    } else {
+        while (i < n && kh_push(q->tasks, q_key(q, tasks[i]->pty), tasks[i])) {
+            i++;
+        }
+        if (i > 0) {
+            q->top_pty = q_key_pty(kh_peek_key(q->tasks));
+        }
+    }
+    q->len += i;
+    pthread_mutex_unlock(&q->lock);
+
+    return i;
+}
+
+static tp_task *q_pop(tp_queue *q) {
+    tp_task *task = null;
+
+    // skip the lock entirely when the queue is known to be empty
+    if (q->len == 0) {
+        return null;
+    }
+
+    pthread_mutex_lock(&q->lock);
+    if (q->tasks == null) {
+        if (q->bits != 0) {
+            // the highest bucket, or the lowest one when it is due for aging
+            size_t b = 31 - __builtin_clz(q->bits);
+            if (q->aging > 0 && ++q->pops >= q->aging) {
+                q->pops = 0;
+                b = __builtin_ctz(q->bits);
+            }
+            task = q->head[b];
+            if ((q->head[b] = task->next) == null) {
+                q->tail[b] = null;
+                q->bits &= ~(1u << b);
+            }
+            if (q->bits != 0) {
+                q->top_pty = 31 - __builtin_clz(q->bits);
+            }
+        }
+    } else if (!kh_empty(q->tasks)) {
+        task = (tp_task *) kh_pop(q->tasks);
+        if (!kh_empty(q->tasks)) {
+            q->top_pty = q_key_pty(kh_peek_key(q->tasks));
+        }
+    }
+    if (task != null) {
+        q->len--;
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    return task;
+}
+
+// parse a sysfs cpu list such as "0-3,8-11" into 'cpus', returns the number of cpus read
+static size_t topo_cpulist(char const *path, int *cpus, size_t m) {
+    FILE *f;
+    if ((f = fopen(path, "r")) == null) {
+        return 0;
+    }
+
+    size_t n = 0;
+    int lo, hi;
+    while (fscanf(f, "%d", &lo) == 1) {
+        hi = lo;
+        int c = fgetc(f);
+        if (c == '-') {
+            if (fscanf(f, "%d", &hi) != 1) {
+                break;
+            }
+            c = fgetc(f);
+        }
+        for (; lo <= hi && n < m; lo++) {
+            cpus[n++] = lo;
+        }
+        if (c != ',') {
+            break;
+        }
+    }
+
+    fclose(f);
+    return n;
+}
+
+static bool tp_topo(threadpool *pool, tp_opts const *opts) {
+    long conf = sysconf(_SC_NPROCESSORS_CONF);
+    size_t ncpu = conf > 0 ? (size_t) conf : 1;
+    size_t i, j, k;
+    bool ok = false;
+
+    // node of every usable cpu, cpus missing from sysfs or outside our affinity mask stay at -1
+    int *node_of = malloc(ncpu * sizeof(int));
+    int *buf = malloc(ncpu * sizeof(int));
+    int *order = malloc(ncpu * sizeof(int));
+    if (node_of == null || buf == null || order == null) {
+        goto done;
+    }
+    for (i = 0; i < ncpu; i++) {
+        node_of[i] = -1;
+    }
+
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) != 0) {
+        CPU_ZERO(&allowed);
+        for (i = 0; i < ncpu && i < CPU_SETSIZE; i++) {
+            CPU_SET(i, &allowed);
+        }
+    }
+
+    size_t nodes = 0;
+    char path[96];
+    for (k = 0; k < TP_MAX_NODES; k++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%zu/cpulist", k);
+        size_t n = topo_cpulist(path, buf, ncpu);
+        bool used = false;
+        for (j = 0; j < n; j++) {
+            if (buf[j] >= 0 && (size_t) buf[j] < ncpu && CPU_ISSET(buf[j], &allowed)) {
+                node_of[buf[j]] = (int) nodes;
+                used = true;
+            }
+        }
+        nodes += used;
+    }
+
+    // no NUMA information, treat every allowed cpu as one node
+    if (nodes == 0) {
+        for (i = 0; i < ncpu && i < CPU_SETSIZE; i++) {
+            if (CPU_ISSET(i, &allowed)) {
+                node_of[i] = 0;
+            }
+        }
+        nodes = 1;
+    }
+
+    // one-per-core keeps only the first hyperthread of each core
+    if (opts->affinity == tpaff_core) {
+        for (i = 0; i < ncpu; i++) {
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%zu/topology/thread_siblings_list", i);
+            if (node_of[i] >= 0 && topo_cpulist(path, buf, ncpu) > 0 && (size_t) buf[0] != i) {
+                node_of[i] = -1;
+            }
+        }
+    }
+
+    // placement order: compact walks node by node, scatter deals cpus round-robin across nodes
+    size_t norder = 0;
+    if (opts->cpus != null && opts->num_cpus > 0) {
+        for (i = 0; i < opts->num_cpus && norder < ncpu; i++) {
+            order[norder++] = opts->cpus[i];
+        }
+    } else if (opts->affinity == tpaff_scatter) {
+        bool more = true;
+        for (j = 0; more; j++) {
+            more = false;
+            for (k = 0; k < nodes; k++) {
+                size_t seen = 0;
+                for (i = 0; i < ncpu; i++) {
+                    if (node_of[i] == (int) k && seen++ == j) {
+                        order[norder++] = (int) i;
+                        more = true;
+                        break;
+                    }
+                }
+            }
+        }
+    } else if (opts->affinity != tpaff_none) {
+        for (k = 0; k < nodes; k++) {
+            for (i = 0; i < ncpu; i++) {
+                if (node_of[i] == (int) k) {
+                    order[norder++] = (int) i;
+                }
+            }
+        }
+    }
+
+    size_t num_qs = opts->numa_queues ? nodes : 1;
+    pool->num_cpus = ncpu;
+    if ((pool->cpu_node = malloc(ncpu * sizeof(size_t))) == null ||
+            (pool->qs = aligned_alloc(TP_CACHE_LINE, num_qs * sizeof(tp_queue))) == null) {
+        goto done;
+    }
+    for (i = 0; i < ncpu; i++) {
+        pool->cpu_node[i] = node_of[i] < 0 || num_qs == 1 ? 0 : (size_t) node_of[i];
+    }
+    for (pool->num_qs = 0; pool->num_qs < num_qs; pool->num_qs++) {
+        if (!q_init(&pool->qs[pool->num_qs], opts->queue, opts->aging)) {
+            goto done;
+        }
+    }
+
+    // workers without a cpu are dealt to the queues round-robin
+    for (i = 0; i < pool->max_ts; i++) {
+        tp_worker *w = &pool->ws[i];
+        w->cpu = norder > 0 ? order[i % norder] : -1;
+        if (w->cpu >= 0 && (size_t) w->cpu < ncpu) {
+            w->node = pool->cpu_node[w->cpu];
+        } else {
+            w->node = i % num_qs;
+        }
+    }
+    ok = true;
+
+    done:
+    free(node_of);
+    free(buf);
+    free(order);
+    return ok;
+}
+
+static size_t tp_home(threadpool *pool) {
+    tp_worker *self = tp_current();
+    if (self != null && self->pool == pool) {
+        return self->node;
+    }
+    if (pool->num_qs == 1) {
+        return 0;
+    }
+
+    int cpu = sched_getcpu();
+    return cpu >= 0 && (size_t) cpu < pool->num_cpus ? pool->cpu_node[cpu] : 0;
+}
+
+void *tp_future_free(void *fut) {
+    tp_future *f = (tp_future *) fut;
+    tp_slab *s = f->slab;
+
+    slab_put(s, slab_worker(s), true, f);
+    slab_unref(s);
+
+    return null;
+}
+
+size_t tp_depth(threadpool *pool) {
+    return pool == null ? 0 : atomic_load(&pool->pending);
+}
+
+int tp_stats(threadpool *pool, tp_stats_t *st) {
+    if (pool == null || st == null) {
+        return tp_invalid;
+    }
+
+    if (pthread_mutex_lock(&pool->slab->lock) != 0) {
+        return tp_lockfail;
+    }
+    st->task_hits = pool->slab->task_hits;
+    st->task_misses = pool->slab->task_misses;
+    st->fut_hits = pool->slab->fut_hits;
+    st->fut_misses = pool->slab->fut_misses;
+    pthread_mutex_unlock(&pool->slab->lock);
+
+    if (pthread_mutex_lock(&pool->lock) != 0) {
+        return tp_lockfail;
+    }
+    st->threads = pool->num_ts;
+    st->grown = pool->grown;
+    st->shrunk = pool->shrunk;
+    pthread_mutex_unlock(&pool->lock);
+
+    st->depth = atomic_load(&pool->pending);
+    st->capacity = pool->capacity;
+    st->depth_hwm = atomic_load(&pool->depth_hwm);
+    st->cancelled = atomic_load(&pool->cancelled);
+    st->expired = atomic_load(&pool->expired);
+    st->tasks_run = st->steals = st->wakeups = st->spurious = 0;
+    memset(st->wait_hist, 0, sizeof(st->wait_hist));
+    memset(st->run_hist, 0, sizeof(st->run_hist));
+
+    size_t i, j;
+    for (i = 0; i < pool->num_ws; i++) {
+        tp_worker *w = &pool->ws[i];
+        st->task_hits += atomic_load_explicit(&w->task_hits, memory_order_relaxed);
+        st->fut_hits += atomic_load_explicit(&w->fut_hits, memory_order_relaxed);
+        st->tasks_run += atomic_load_explicit(&w->st.tasks_run, memory_order_relaxed);
+        st->steals += atomic_load_explicit(&w->st.steals, memory_order_relaxed);
+        st->wakeups += atomic_load_explicit(&w->st.wakeups, memory_order_relaxed);
+        st->spurious += atomic_load_explicit(&w->st.spurious, memory_order_relaxed);
+        for (j = 0; j < TP_HIST_BUCKETS; j++) {
+            st->wait_hist[j] += atomic_load_explicit(&w->st.wait_hist[j], memory_order_relaxed);
+            st->run_hist[j] += atomic_load_explicit(&w->st.run_hist[j], memory_order_relaxed);
+        }
+    }
+
+    return 0;
+}
+
+int tp_worker_stats(threadpool *pool, size_t i, tp_wstats_t *st) {
+    if (pool == null || st == null || i >= pool->num_ws) {
+        return tp_invalid;
+    }
+
+    tp_wstats *ws = &pool->ws[i].st;
+    st->tasks_run = atomic_load_explicit(&ws->tasks_run, memory_order_relaxed);
+    st->steals = atomic_load_explicit(&ws->steals, memory_order_relaxed);
+    st->wakeups = atomic_load_explicit(&ws->wakeups, memory_order_relaxed);
+    st->spurious = atomic_load_explicit(&ws->spurious, memory_order_relaxed);
+    st->busy_ns = atomic_load_explicit(&ws->busy_ns, memory_order_relaxed);
+    st->alive_ns = atomic_load_explicit(&ws->alive_ns, memory_order_relaxed);
+
+    uint64_t start = atomic_load_explicit(&ws->start_ns, memory_order_relaxed);
+    if (start != 0) {
+        st->alive_ns += tp_now() - start;
+    }
+
+    return 0;
+}
+
+static bool tp_spin(threadpool *pool) {
+    uint64_t until = tp_now() + pool->spin_ns;
+    unsigned i;
+
+    for (i = 1; ; i++) {
+        if (atomic_load(&pool->pending) > 0) {
+            return true;
+        }
+
+        // shutting down is handled where the worker parks
+        if (pool->shutdown) {
+            return false;
+        }
+
+        // check the clock and give up the cpu every so often, pause in between
+        if (i % TP_SPIN_CHECK == 0) {
+            if (tp_now() >= until) {
+                return false;
+            }
+            sched_yield();
+        } else {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#elif defined(__aarch64__)
+            __asm__ volatile("yield");
+#endif
+        }
+    }
+}
+
+static uint64_t tp_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+static void tp_bump(atomic_size_t *c, size_t n) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+// log-linear buckets: exact below 4, then four buckets per power of two
+static size_t tp_hist_bucket(uint64_t v) {
+    if (v < 4) {
+        return (size_t) v;
+    }
+    unsigned e = 63 - __builtin_clzll(v);
+    return (e - 1) * 4 + ((v >> (e - 2)) & 3);
+}
+
+uint64_t tp_hist_value(size_t b) {
+    if (b < 4) {
+        return b;
+    }
+    unsigned e = (unsigned) (b / 4) + 1;
+    return (uint64_t) (4 + b % 4) << (e - 2);
+}
+
+uint64_t tp_hist_quantile(size_t const *hist, double q) {
+    size_t b, total = 0;
+    for (b = 0; b < TP_HIST_BUCKETS; b++) {
+        total += hist[b];
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    size_t rank = (size_t) (q * (double) (total - 1)), seen = 0;
+    for (b = 0; b < TP_HIST_BUCKETS; b++) {
+        seen += hist[b];
+        if (seen > rank) {
+            return tp_hist_value(b);
+        }
+    }
+
+    return tp_hist_value(TP_HIST_BUCKETS - 1);
+}
+
+static tp_slab *slab_init(void) {
+    tp_slab *s;
+    if ((s = malloc(sizeof(tp_slab))) == null) {
+        return null;
+    }
+
+    if (pthread_mutex_init(&s->lock, null) != 0) {
+        free(s);
+        return null;
+    }
+    atomic_init(&s->refs, 1);
+    s->tasks.head = s->futs.head = null;
+    s->tasks.n = s->futs.n = 0;
+    s->chunks = null;
+    s->task_hits = s->task_misses = 0;
+    s->fut_hits = s->fut_misses = 0;
+
+    return s;
+}
+
+static void slab_unref(tp_slab *s) {
+    if (atomic_fetch_sub(&s->refs, 1) != 1) {
+        return;
+    }
+
+    // last reference, every object is back in a chunk
+    while (s->chunks != null) {
+        tp_chunk *c = s->chunks;
+        s->chunks = c->next;
+        if (c->futs) {
+            size_t i;
+            for (i = 0; i < TP_SLAB_CHUNK; i++) {
+                tp_future *f = (tp_future *) ((char *) c->objs + i * sizeof(tp_future));
+                pthread_mutex_destroy(&f->lock);
+                pthread_cond_destroy(&f->notify);
+            }
+        }
+        free(c);
+    }
+
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+}
+
+static tp_worker *slab_worker(tp_slab *s) {
+    tp_worker *w = tp_current();
+    return w != null && w->pool->slab == s ? w : null;
+}
+
+static void list_push(tp_freelist *l, tp_link *a) {
+    a->next = l->head;
+    l->head = a;
+    l->n++;
+}
+
+static tp_link *list_pop(tp_freelist *l) {
+    tp_link *a = l->head;
+    l->head = a->next;
+    l->n--;
+    return a;
+}
+
+// carve a new chunk into the shared freelist, called with the slab lock held
+static bool slab_grow(tp_slab *s, bool fut) {
+    size_t size = fut ? sizeof(tp_future) : sizeof(tp_task);
+    tp_chunk *c;
+    if ((c = malloc(sizeof(tp_chunk) + TP_SLAB_CHUNK * size)) == null) {
+        return false;
+    }
+    c->futs = fut;
+
+    size_t i;
+    for (i = 0; i < TP_SLAB_CHUNK; i++) {
+        void *a = (char *) c->objs + i * size;
+        if (fut) {
+            pthread_mutex_init(&((tp_future *) a)->lock, null);
+            pthread_cond_init(&((tp_future *) a)->notify, null);
+        }
+        list_push(fut ? &s->futs : &s->tasks, a);
+    }
+
+    c->next = s->chunks;
+    s->chunks = c;
+
+    return true;
+}
+
+static void *slab_get(tp_slab *s, tp_worker *w, bool fut) {
+    tp_freelist *local = w == null ? null : (fut ? &w->futs : &w->tasks);
+    tp_freelist *shared = fut ? &s->futs : &s->tasks;
+    tp_link *a;
+
+    // worker cache first, no locking needed
+    if (local != null && local->head != null) {
+        atomic_fetch_add_explicit(fut ? &w->fut_hits : &w->task_hits, 1, memory_order_relaxed);
+        return list_pop(local);
+    }
+
+    if (pthread_mutex_lock(&s->lock) != 0) {
+        return null;
+    }
+
+    if (shared->head != null) {
+        fut ? s->fut_hits++ : s->task_hits++;
+    } else if (slab_grow(s, fut)) {
+        fut ? s->fut_misses++ : s->task_misses++;
+    } else {
+        pthread_mutex_unlock(&s->lock);
+        return null;
+    }
+    a = list_pop(shared);
+
+    // refill the worker cache while we hold the lock
+    if (local != null) {
+        while (shared->head != null && local->n < TP_SLAB_BATCH) {
+            list_push(local, list_pop(shared));
+        }
+    }
+
+    pthread_mutex_unlock(&s->lock);
+    return a;
+}
+
+static bool slab_get_many(tp_slab *s, tp_worker *w, bool fut, void **as, size_t n) {
+    tp_freelist *local = w == null ? null : (fut ? &w->futs : &w->tasks);
+    tp_freelist *shared = fut ? &s->futs : &s->tasks;
+    size_t i = 0;
+
+    while (local != null && local->head != null && i < n) {
+        as[i++] = list_pop(local);
+    }
+    if (i > 0) {
+        atomic_fetch_add_explicit(fut ? &w->fut_hits : &w->task_hits, i, memory_order_relaxed);
+    }
+    if (i == n) {
+        return true;
+    }
+
+    // take the rest under a single lock
+    if (pthread_mutex_lock(&s->lock) == 0) {
+        for (; i < n; i++) {
+            if (shared->head != null) {
+                fut ? s->fut_hits++ : s->task_hits++;
+            } else if (slab_grow(s, fut)) {
+                fut ? s->fut_misses++ : s->task_misses++;
+            } else {
+                break;
+            }
+            as[i] = list_pop(shared);
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+
+    if (i < n) {
+        while (i > 0) {
+            slab_put(s, w, fut, as[--i]);
+        }
+        return false;
+    }
+
+    return true;
+}
+
+static void slab_put(tp_slab *s, tp_worker *w, bool fut, void *a) {
+    tp_freelist *local = w == null ? null : (fut ? &w->futs : &w->tasks);
+    tp_freelist *shared = fut ? &s->futs : &s->tasks;
+
+    if (local != null) {
+        list_push(local, a);
+        if (local->n <= TP_SLAB_CACHE) {
+            return;
+        }
+    }
+
+    pthread_mutex_lock(&s->lock);
+    if (local == null) {
+        list_push(shared, a);
+    } else {
+        // worker cache overflowed, give half of it back so other threads can use it
+        while (local->n > TP_SLAB_CACHE / 2) {
+            list_push(shared, list_pop(local));
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+static tp_dqbuf *dq_buf(long size) {
+    tp_dqbuf *a;
+    if ((a = malloc(sizeof(tp_dqbuf) + size * sizeof(_Atomic(tp_task *)))) == null) {
+        return null;
+    }
+    a->size = size;
+    a->prev = null;
+
+    return a;
+}
+
+static bool dq_init(tp_deque *dq, long size) {
+    atomic_init(&dq->top, 0);
+    atomic_init(&dq->bottom, 0);
+
+    // the heap scheduler never touches the deques
+    if (size == 0) {
+        atomic_init(&dq->buf, null);
+        return true;
+    }
+
+    tp_dqbuf *a;
+    if ((a = dq_buf(size)) == null) {
+        return false;
+    }
+    atomic_init(&dq->buf, a);
+
+    return true;
+}
+
+static void dq_free(tp_deque *dq) {
+    tp_dqbuf *a = atomic_load(&dq->buf);
+    while (a != null) {
+        tp_dqbuf *prev = a->prev;
+        free(a);
+        a = prev;
+    }
+}
+
+static bool dq_push(tp_deque *dq, tp_task *task) {
+    long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&dq->top, memory_order_acquire);
+    tp_dqbuf *a = atomic_load_explicit(&dq->buf, memory_order_relaxed);
+
+    if (b - t > a->size - 1) {
+        // full, grow into a buffer twice the size; thieves may still read the old one
+        tp_dqbuf *new_a;
+        if ((new_a = dq_buf(a->size << 1)) == null) {
+            return false;
+        }
+        long i;
+        for (i = t; i < b; i++) {
+            atomic_store_explicit(&new_a->as[i & (new_a->size - 1)],
+                    atomic_load_explicit(&a->as[i & (a->size - 1)], memory_order_relaxed),
+                    memory_order_relaxed);
+        }
+        new_a->prev = a;
+        atomic_store_explicit(&dq->buf, new_a, memory_order_release);
+        a = new_a;
+    }
+
+    atomic_store_explicit(&a->as[b & (a->size - 1)], task, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+
+    return true;
+}
+
+static tp_task *dq_take(tp_deque *dq) {
+    tp_dqbuf *a = atomic_load_explicit(&dq->buf, memory_order_relaxed);
+    if (a == null) {
+        return null;
+    }
+
+    long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&dq->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&dq->top, memory_order_relaxed);
+
+    tp_task *task = null;
+    if (t <= b) {
+        task = atomic_load_explicit(&a->as[b & (a->size - 1)], memory_order_relaxed);
+        if (t == b) {
+            // last element, race the thieves for it
+            if (!atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+                    memory_order_seq_cst, memory_order_relaxed)) {
+                task = null;
+            }
+            atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+        }
+    } else {
+        atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+    }
+
+    return task;
+}
+
+static tp_task *dq_steal(tp_deque *dq) {
+    long t = atomic_load_explicit(&dq->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&dq->bottom, memory_order_acquire);
+
+    if (t < b) {
+        tp_dqbuf *a = atomic_load_explicit(&dq->buf, memory_order_acquire);
+        tp_task *task = atomic_load_explicit(&a->as[t & (a->size - 1)], memory_order_relaxed);
+        if (!atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+                memory_order_seq_cst, memory_order_relaxed)) {
+            // lost the race to the owner or another thief
+            return null;
+        }
+        return task;
+    }
 
     return null;
 }
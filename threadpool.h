@@ -1,16 +1,29 @@
 #ifndef THREADPOOL
 #define THREADPOOL
 
+#include <stddef.h>
+#include <stdint.h>
 #include "defs.h"
 
+// buckets in the latency histograms of tp_stats_t
+#define TP_HIST_BUCKETS 256
+
+// priority levels of the tpq_buckets queue
+#define TP_BUCKETS 16
+
 typedef enum {
     tp_invalid = -1,
     tp_lockfail = -2,
     tp_shutdown = -3,
-    tp_threadfail = -4
+    tp_threadfail = -4,
+    // the task was skipped by a cancelled token, its deadline, or a shutdown
+    tp_cancelled = -5,
+    // the bounded queue had no room in time
+    tp_full = -6
 } err_tp;
 
 typedef enum {
+    tpexit_now = 0,
     tpexit_graceful = 1
 } dflags_tp;
 
@@ -19,26 +32,237 @@ typedef enum {
     tpsdown_soft = 2
 } sflags_tp;
 
+typedef enum {
+    // every task goes through one shared priority heap
+    tpsched_heap = 0,
+    // each worker owns a deque, tasks submitted from a worker stay local and idle workers steal
+    tpsched_steal = 1
+} tp_sched;
+
+typedef enum {
+    // leave workers to the OS scheduler
+    tpaff_none = 0,
+    // fill the cpus of one node before moving to the next
+    tpaff_compact = 1,
+    // spread workers across nodes round-robin
+    tpaff_scatter = 2,
+    // compact, but only one worker per physical core
+    tpaff_core = 3
+} tp_affinity;
+
+typedef enum {
+    // a binary heap ordered by priority, any int priority
+    tpq_heap = 0,
+    // one FIFO per priority found through a bitmap in O(1), priorities are clamped to [0, TP_BUCKETS)
+    tpq_buckets = 1
+} tp_qkind;
+
+// options for tp_init_opts, zero-initialize and set the fields needed
+typedef struct {
+    // number of worker threads, the minimum when the pool is elastic
+    size_t num_ts;
+    // scheduling mode (tp_sched)
+    int sched;
+    // when above num_ts the pool is elastic and grows up to max_ts threads
+    size_t max_ts;
+    // grow while there are more than this many queued tasks per thread, 0 means 1
+    size_t grow_backlog;
+    // retire threads above num_ts that have been idle this long, 0 means one second
+    unsigned idle_ms;
+    // idle workers poll for new work this long before parking, trading cpu for start latency, 0 parks at once
+    unsigned spin_us;
+    // pin workers according to a tp_affinity policy, ignored when 'cpus' is set
+    int affinity;
+    // explicit cpu ids, worker i is pinned to cpus[i % num_cpus]
+    int const *cpus;
+    size_t num_cpus;
+    // keep one shared queue per NUMA node, tasks prefer workers on the submitter's node
+    bool numa_queues;
+    // kind of the shared queues (tp_qkind)
+    int queue;
+    // with tpq_buckets, serve the lowest non-empty priority once every 'aging' pops so it can't starve, 0 disables
+    unsigned aging;
+    // record latency histograms and per-worker counters, see tp_stats and tp_worker_stats
+    bool stats;
+    // run every task on a fiber with a stack of this many bytes, 0 runs tasks on the worker's own stack
+    // a task that awaits an unresolved future then suspends and frees its worker instead of blocking it
+    size_t fiber_stack;
+    // bound the queued tasks, 0 for no bound; submitters outside the pool are throttled when it is reached
+    // while tasks submitted by the pool's own workers always go through so they can't deadlock
+    size_t capacity;
+} tp_opts;
+
+// snapshot of the threadpool counters
+typedef struct {
+    // task and future allocations served from recycled objects
+    size_t task_hits;
+    size_t fut_hits;
+    // task and future allocations that had to carve a new slab chunk
+    size_t task_misses;
+    size_t fut_misses;
+    // running threads and the number of threads started and retired by elastic resizing
+    size_t threads;
+    size_t grown;
+    size_t shrunk;
+    // queued tasks now and at the most, the high-water mark is only tracked with stats on
+    size_t depth;
+    size_t depth_hwm;
+    // the bound on queued tasks, 0 for none
+    size_t capacity;
+    // the fields below are only filled with stats on
+    size_t tasks_run;
+    size_t steals;
+    size_t wakeups;
+    // wakeups after which the worker found nothing to run
+    size_t spurious;
+    // tasks skipped at dequeue because their token was cancelled or their deadline had passed
+    size_t cancelled;
+    size_t expired;
+    // enqueue-to-start latency and run time in ns, read them with tp_hist_quantile
+    size_t wait_hist[TP_HIST_BUCKETS];
+    size_t run_hist[TP_HIST_BUCKETS];
+} tp_stats_t;
+
+// counters of a single worker slot, only filled with stats on
+typedef struct {
+    size_t tasks_run;
+    size_t steals;
+    size_t wakeups;
+    size_t spurious;
+    // time spent running tasks and time the slot has had a live thread, their ratio is the utilization
+    uint64_t busy_ns;
+    uint64_t alive_ns;
+} tp_wstats_t;
+
+// cancellation token, shared by any number of tasks
+typedef struct tp_token tp_token;
+
+// a unit of work for the batch submission functions, zero-initialize and set the fields needed
+typedef struct {
+    void_ptr (*func)(void_ptr);
+    void_ptr arg;
+    int priority;
+    // the task is skipped if the token is cancelled before it starts
+    tp_token *token;
+    // the task is skipped if it hasn't started this many milliseconds after submission, 0 for none
+    uint64_t deadline_ms;
+} tp_job;
+
+// handle of a timer armed with tp_add_after or tp_add_every, 0 is never a valid handle
+typedef uint64_t tp_timer;
+
 // future struct
 typedef struct tp_future tp_future;
 
 // struct to store the threadpool in
 typedef struct threadpool threadpool;
 
-// initialize the threadpool with num_ts threads and a queue of initial size q_size; return null on failure
+// initialize the threadpool with num_ts threads using the shared heap scheduler; return null on failure
 extern threadpool *tp_init(size_t num_ts);
 
+// initialize the threadpool with the given options; return null on failure
+extern threadpool *tp_init_opts(tp_opts const *opts);
+
 // add a function to the task pool; returns 0 on success and an err_tp on failure
+// waits for room when the pool is bounded and full
 // note: any return value for func is ignored
 extern int tp_add(threadpool *pool, void_ptr (*func)(void_ptr), void_ptr arg, int priority);
 
+// same as tp_add, returning tp_full instead of waiting when the pool is full
+extern int tp_try_add(threadpool *pool, void_ptr (*func)(void_ptr), void_ptr arg, int priority);
+
+// same as tp_add, returning tp_full if there is no room within 'timeout_ms' milliseconds
+extern int tp_add_timed(threadpool *pool, void_ptr (*func)(void_ptr), void_ptr arg, int priority,
+        uint64_t timeout_ms);
+
 // add a function to the task pool; return a tp_future on success and null on failure
-extern tp_future *tp_promise(threadpool *pool, void_ptr (*func), void_ptr arg, int priority);
+// waits for room when the pool is bounded and full
+extern tp_future *tp_promise(threadpool *pool, void_ptr (*func)(void_ptr), void_ptr arg, int priority);
+
+// add 'n' jobs to the task pool under a single lock, waking at most one worker per job
+// a bounded pool takes as many as fit, waiting only while it is full
+// returns the number of jobs queued, or an err_tp if none could be queued
+extern int tp_add_batch(threadpool *pool, tp_job const *jobs, size_t n);
+
+// same as tp_add_batch, storing a tp_future for each job in 'futs' (null for jobs that were not queued)
+extern int tp_promise_batch(threadpool *pool, tp_job const *jobs, size_t n, tp_future **futs);
 
-// destroy the given threadpool in the manner determined by the flag (sflags_tp)
+// run func on the result of 'fut' once it resolves, without blocking; consumes 'fut'
+// returns a tp_future for the result of func, or null on failure in which case 'fut' is left untouched
+// if 'fut' is cancelled func doesn't run and the returned future is cancelled too
+extern tp_future *tp_then(threadpool *pool, tp_future *fut, void_ptr (*func)(void_ptr), int priority);
+
+// combine 'n' futures into one that resolves once all of them have; consumes the futures
+// the result is a malloc'd array of the 'n' results in order, to be freed by the caller
+// the combined future is cancelled if any of the futures is
+// returns null without consuming anything if a future in 'futs' is null
+extern tp_future *tp_when_all(threadpool *pool, tp_future **futs, size_t n);
+
+// combine 'n' futures into one that resolves with the first result available; consumes the futures
+// cancelled futures are passed over, the combined future is only cancelled if all of them are
+// returns null without consuming anything if a future in 'futs' is null
+extern tp_future *tp_when_any(threadpool *pool, tp_future **futs, size_t n);
+
+// queue func once 'delay_ms' milliseconds have passed; return a tp_timer on success and 0 on failure
+// timers that haven't fired when the pool is destroyed are dropped
+extern tp_timer tp_add_after(threadpool *pool, uint64_t delay_ms, void_ptr (*func)(void_ptr), void_ptr arg,
+        int priority);
+
+// queue func every 'period_ms' milliseconds until cancelled; return a tp_timer on success and 0 on failure
+extern tp_timer tp_add_every(threadpool *pool, uint64_t period_ms, void_ptr (*func)(void_ptr), void_ptr arg,
+        int priority);
+
+// disarm a timer; returns 0 on success and tp_invalid if it has already fired or been cancelled
+extern int tp_cancel(threadpool *pool, tp_timer t);
+
+// destroy the given threadpool in the manner determined by the flag (dflags_tp)
+// tpexit_graceful (or tpsdown_soft) runs the queued tasks first, tpexit_now drops them
+// tpsdown_now has the same value as tpexit_graceful, so it can't ask for an immediate shutdown here
 extern int tp_dest(threadpool *pool, int flags);
 
 // wait for the queue to empty and return
+// called from a task of a pool with fibers the task is suspended until 'fut' resolves, possibly resuming on another worker
 extern void_ptr tp_await(threadpool *pool, tp_future *fut);
 
+// wait for the future and store its result in 'ret'; consumes 'fut'
+// returns 0 when the task ran and tp_cancelled when it was skipped, in which case 'ret' is null
+extern int tp_await_status(threadpool *pool, tp_future *fut, void_ptr *ret);
+
+// create a cancellation token; return null on failure
+extern tp_token *tp_token_init(void);
+
+// cancel every task holding the token that hasn't started yet, running tasks can poll tp_token_cancelled
+extern void tp_token_cancel(tp_token *tok);
+
+// whether the token has been cancelled
+extern bool tp_token_cancelled(tp_token const *tok);
+
+// release the caller's reference, queued tasks keep the token alive until they are dequeued
+extern void tp_token_free(tp_token *tok);
+
+// run body(ctx, lo, hi) over [0, n) split into chunks of 'grain' items, returning once every chunk is done
+// the calling thread runs chunks too, so this is safe to call from inside a task; a grain of 0 uses tp_grain
+// note: any return value for body is ignored
+// returns 0 on success and an err_tp on failure
+extern int tp_parallel_for(threadpool *pool, size_t n, size_t grain,
+        void_ptr (*body)(void_ptr, size_t, size_t), void_ptr ctx);
+
+// default chunk size for splitting 'n' items across the pool's workers
+extern size_t tp_grain(threadpool *pool, size_t n);
+
+// number of queued tasks, for shedding load before a bounded pool fills up
+extern size_t tp_depth(threadpool *pool);
+
+// fill 'st' with a snapshot of the pool's counters; returns 0 on success and an err_tp on failure
+extern int tp_stats(threadpool *pool, tp_stats_t *st);
+
+// fill 'st' with the counters of worker slot 'i'; returns 0 on success and an err_tp on failure
+extern int tp_worker_stats(threadpool *pool, size_t i, tp_wstats_t *st);
+
+// lower bound in ns of histogram bucket 'b'
+extern uint64_t tp_hist_value(size_t b);
+
+// value in ns at quantile 'q' (0 to 1) of a tp_stats_t histogram
+extern uint64_t tp_hist_quantile(size_t const *hist, double q);
+
 #endif